@@ -2,8 +2,41 @@
 #pragma once
 #include <raylib.h>
 #include <raygui.h>
+#include <algorithm>
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
 #include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+#if defined(_WIN32)
+// Keep windows.h from declaring its own Rectangle, LoadImage, DrawText, CloseWindow, ...
+#define WIN32_LEAN_AND_MEAN
+#define NOGDI
+#define NOUSER
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 namespace Collision {
 
@@ -18,27 +51,104 @@ inline bool PointInTriangle(const Vector2 &P, const Vector2 &A, const Vector2 &B
     return area < 0 ? (s <= 0 && s + t >= area) : (s >= 0 && s + t <= area);
 }
 
-// Check collision between two rectangles represented by 4 corners each
-inline bool CheckCollisionRectCorners(const std::array<Vector2, 4> &rect1, const std::array<Vector2, 4> &rect2) {
-    // Split each rectangle into two triangles
-    std::array<std::array<Vector2, 3>, 2> tris1 = {{{rect1[0], rect1[1], rect1[2]}, {rect1[0], rect1[2], rect1[3]}}};
-    std::array<std::array<Vector2, 3>, 2> tris2 = {{{rect2[0], rect2[1], rect2[2]}, {rect2[0], rect2[2], rect2[3]}}};
+// Rotated rectangle stored as its center, its half size along its own axes and the
+// unit vector of its local X axis (cos, sin of its rotation).
+struct OrientedBox {
+    Vector2 center;
+    Vector2 halfExtents;
+    Vector2 axis;
+};
 
-    // Check all triangle pairs
-    for (auto &t1 : tris1) {
-        for (auto &t2 : tris2) {
-            // Check if any vertex of t1 is inside t2
-            for (const auto &v : t1) {
-                if (PointInTriangle(v, t2[0], t2[1], t2[2])) return true;
-            }
-            // Check if any vertex of t2 is inside t1
-            for (const auto &v : t2) {
-                if (PointInTriangle(v, t1[0], t1[1], t1[2])) return true;
+inline OrientedBox MakeOrientedBox(Vector2 center, Vector2 halfExtents, float angleRad) {
+    return {center, halfExtents, {cosf(angleRad), sinf(angleRad)}};
+}
+
+// Half size of the box's axis-aligned bounds.
+inline Vector2 GetOrientedBoxReach(const OrientedBox &box) {
+    float cosine = fabsf(box.axis.x), sine = fabsf(box.axis.y);
+    return {box.halfExtents.x * cosine + box.halfExtents.y * sine, box.halfExtents.x * sine + box.halfExtents.y * cosine};
+}
+
+inline Rectangle GetOrientedBoxBounds(const OrientedBox &box) {
+    Vector2 reach = GetOrientedBoxReach(box);
+    return {box.center.x - reach.x, box.center.y - reach.y, reach.x * 2, reach.y * 2};
+}
+
+// Separating axis test against an axis-aligned rectangle. The world axes are the AABB
+// early-out, so only the box's own two axes are left to check.
+inline bool CheckCollisionBoxRec(const OrientedBox &box, const Rectangle &rect) {
+    Vector2 rectHalf = {rect.width / 2, rect.height / 2};
+    Vector2 delta = {rect.x + rectHalf.x - box.center.x, rect.y + rectHalf.y - box.center.y};
+    Vector2 reach = GetOrientedBoxReach(box);
+    if (fabsf(delta.x) > reach.x + rectHalf.x || fabsf(delta.y) > reach.y + rectHalf.y) return false;
+
+    float cosine = box.axis.x, sine = box.axis.y;
+    float distanceAlongX = fabsf(delta.x * cosine + delta.y * sine);
+    float rectReachAlongX = rectHalf.x * fabsf(cosine) + rectHalf.y * fabsf(sine);
+    if (distanceAlongX > box.halfExtents.x + rectReachAlongX) return false;
+    float distanceAlongY = fabsf(-delta.x * sine + delta.y * cosine);
+    float rectReachAlongY = rectHalf.x * fabsf(sine) + rectHalf.y * fabsf(cosine);
+    return distanceAlongY <= box.halfExtents.y + rectReachAlongY;
+}
+
+// Separating axis test between two rotated boxes, after an AABB early-out.
+inline bool CheckCollisionBoxes(const OrientedBox &a, const OrientedBox &b) {
+    Vector2 delta = {b.center.x - a.center.x, b.center.y - a.center.y};
+    Vector2 reachA = GetOrientedBoxReach(a), reachB = GetOrientedBoxReach(b);
+    if (fabsf(delta.x) > reachA.x + reachB.x || fabsf(delta.y) > reachA.y + reachB.y) return false;
+
+    const OrientedBox *boxes[2] = {&a, &b};
+    for (const OrientedBox *owner: boxes) {
+        const OrientedBox &other = owner == &a ? b : a;
+        Vector2 axes[2] = {owner->axis, {-owner->axis.y, owner->axis.x}};
+        float ownerHalf[2] = {owner->halfExtents.x, owner->halfExtents.y};
+        for (int i = 0; i < 2; i++) {
+            Vector2 axis = axes[i];
+            float otherCos = fabsf(axis.x * other.axis.x + axis.y * other.axis.y);
+            float otherSin = fabsf(-axis.x * other.axis.y + axis.y * other.axis.x);
+            float otherReach = other.halfExtents.x * otherCos + other.halfExtents.y * otherSin;
+            if (fabsf(delta.x * axis.x + delta.y * axis.y) > ownerHalf[i] + otherReach) return false;
+        }
+    }
+    return true;
+}
+
+// Tests one rectangle against count boxes laid out back to back, writing 1 into hits[i]
+// for every overlap. Returns the number of hits.
+inline int CheckCollisionRecBoxes(const Rectangle &rect, const OrientedBox *boxes, int count, uint8_t *hits) {
+    int numHits = 0;
+    for (int i = 0; i < count; i++) {
+        hits[i] = CheckCollisionBoxRec(boxes[i], rect);
+        numHits += hits[i];
+    }
+    return numHits;
+}
+
+// General separating axis test for two convex quads given as 4 corners in winding order.
+inline bool CheckCollisionQuads(const std::array<Vector2, 4> &quad1, const std::array<Vector2, 4> &quad2) {
+    const std::array<Vector2, 4> *quads[2] = {&quad1, &quad2};
+    for (const auto *quad: quads) {
+        for (int i = 0; i < 2; i++) {
+            Vector2 edge = {(*quad)[i + 1].x - (*quad)[i].x, (*quad)[i + 1].y - (*quad)[i].y};
+            Vector2 axis = {-edge.y, edge.x};
+            float min1 = INFINITY, max1 = -INFINITY, min2 = INFINITY, max2 = -INFINITY;
+            for (int j = 0; j < 4; j++) {
+                float projection1 = quad1[j].x * axis.x + quad1[j].y * axis.y;
+                float projection2 = quad2[j].x * axis.x + quad2[j].y * axis.y;
+                min1 = std::min(min1, projection1);
+                max1 = std::max(max1, projection1);
+                min2 = std::min(min2, projection2);
+                max2 = std::max(max2, projection2);
             }
+            if (max1 < min2 || max2 < min1) return false;
         }
     }
+    return true;
+}
 
-    return false;
+// Check collision between two rectangles represented by 4 corners each
+inline bool CheckCollisionRectCorners(const std::array<Vector2, 4> &rect1, const std::array<Vector2, 4> &rect2) {
+    return CheckCollisionQuads(rect1, rect2);
 }
 
 inline bool CheckCollisionRectCornersRec(const Rectangle &rect, const std::array<Vector2, 4> &rotated) {
@@ -49,24 +159,7 @@ inline bool CheckCollisionRectCornersRec(const Rectangle &rect, const std::array
         {rect.x + rect.width, rect.y + rect.height},
         {rect.x, rect.y + rect.height}
     }};
-
-    // Split both into triangles
-    std::array<std::array<Vector2, 3>, 2> trisRect = {{{rectCorners[0], rectCorners[1], rectCorners[2]},
-                                                       {rectCorners[0], rectCorners[2], rectCorners[3]}}};
-    std::array<std::array<Vector2, 3>, 2> trisRot = {{{rotated[0], rotated[1], rotated[2]},
-                                                      {rotated[0], rotated[2], rotated[3]}}};
-
-    // Check all triangle pairs
-    for (auto &t1 : trisRect) {
-        for (auto &t2 : trisRot) {
-            for (const auto &v : t1)
-                if (PointInTriangle(v, t2[0], t2[1], t2[2])) return true;
-            for (const auto &v : t2)
-                if (PointInTriangle(v, t1[0], t1[1], t1[2])) return true;
-        }
-    }
-
-    return false;
+    return CheckCollisionQuads(rectCorners, rotated);
 }
 
 inline bool CheckCollisionPointRectCorners(const Vector2 &point, const std::array<Vector2, 4> &rectCorners) {
@@ -81,12 +174,604 @@ inline bool CheckCollisionPointRectCorners(const Vector2 &point, const std::arra
            PointInTriangle(point, tris[1][0], tris[1][1], tris[1][2]);
 }
 
+// Broad phase over a fixed region: items are bucketed by every cell their bounding box
+// touches and queries only look at the cells around the box being tested. Rebuilt each
+// tick with a counting sort, so nothing is allocated once the buffers have grown.
+// Items outside the region are clamped into the border cells. Queries do not modify the
+// grid, so several threads can query it at once.
+class UniformGrid {
+public:
+    Rectangle bounds;
+    float cellSize;
+    int numColumns;
+    int numRows;
+
+    UniformGrid(Rectangle bounds, float cellSize) {
+        this->bounds = bounds;
+        this->cellSize = cellSize;
+        this->numColumns = std::max(1, (int)std::ceil(bounds.width / cellSize));
+        this->numRows = std::max(1, (int)std::ceil(bounds.height / cellSize));
+        cellStart.assign(numColumns * numRows + 1, 0);
+        cellCursor.assign(numColumns * numRows, 0);
+    }
+
+    void clear() {
+        entries.clear();
+        itemLayers.clear();
+        itemMinColumns.clear();
+        itemMinRows.clear();
+    }
+    int size() const {
+        return (int)itemLayers.size();
+    }
+    // Items are numbered in insertion order, starting from 0 after each clear().
+    int insert(Rectangle aabb, uint32_t layer) {
+        int item = (int)itemLayers.size();
+        itemLayers.push_back(layer);
+        int minColumn, minRow, maxColumn, maxRow;
+        getCellRange(aabb, minColumn, minRow, maxColumn, maxRow);
+        itemMinColumns.push_back(minColumn);
+        itemMinRows.push_back(minRow);
+        for (int row = minRow; row <= maxRow; row++) {
+            for (int column = minColumn; column <= maxColumn; column++) {
+                entries.push_back({row * numColumns + column, item});
+            }
+        }
+        return item;
+    }
+    void build() {
+        std::fill(cellStart.begin(), cellStart.end(), 0);
+        for (const Entry &entry: entries) cellStart[entry.cell + 1]++;
+        for (size_t i = 1; i < cellStart.size(); i++) cellStart[i] += cellStart[i - 1];
+        std::copy(cellStart.begin(), cellStart.end() - 1, cellCursor.begin());
+        cellItems.resize(entries.size());
+        for (const Entry &entry: entries) cellItems[cellCursor[entry.cell]++] = entry.item;
+    }
+    // Calls visit(item) once for every item near aabb whose layer is in layerMask and
+    // returns how many were visited. Layers are filtered before the caller sees a pair.
+    // An item in several of the cells searched is only reported from the first of them,
+    // the top-left corner of where its cells and the query's overlap.
+    template <typename Visitor>
+    int query(Rectangle aabb, uint32_t layerMask, Visitor &&visit) const {
+        int numVisited = 0;
+        int minColumn, minRow, maxColumn, maxRow;
+        getCellRange(aabb, minColumn, minRow, maxColumn, maxRow);
+        for (int row = minRow; row <= maxRow; row++) {
+            for (int column = minColumn; column <= maxColumn; column++) {
+                int cell = row * numColumns + column;
+                for (int i = cellStart[cell]; i < cellStart[cell + 1]; i++) {
+                    int item = cellItems[i];
+                    if (!(itemLayers[item] & layerMask)) continue;
+                    if (column != std::max(minColumn, itemMinColumns[item]) || row != std::max(minRow, itemMinRows[item])) continue;
+                    numVisited++;
+                    visit(item);
+                }
+            }
+        }
+        return numVisited;
+    }
+
+private:
+    struct Entry {
+        int cell;
+        int item;
+    };
+    std::vector<Entry> entries;
+    std::vector<int> cellStart;
+    std::vector<int> cellCursor;
+    std::vector<int> cellItems;
+    std::vector<uint32_t> itemLayers;
+    std::vector<int> itemMinColumns;
+    std::vector<int> itemMinRows;
+
+    void getCellRange(Rectangle aabb, int &minColumn, int &minRow, int &maxColumn, int &maxRow) const {
+        minColumn = std::clamp((int)std::floor((aabb.x - bounds.x) / cellSize), 0, numColumns - 1);
+        minRow = std::clamp((int)std::floor((aabb.y - bounds.y) / cellSize), 0, numRows - 1);
+        maxColumn = std::clamp((int)std::floor((aabb.x + aabb.width - bounds.x) / cellSize), 0, numColumns - 1);
+        maxRow = std::clamp((int)std::floor((aabb.y + aabb.height - bounds.y) / cellSize), 0, numRows - 1);
+    }
+};
+
 } // namespace Collision
 
-namespace Random {
-float GetRandomFloat(float min, float max) {
-    return min + (float)GetRandomValue(0, 10000) / 10000.0f * (max - min);
+namespace Kinematics {
+// position[i] += velocity[i] * dt for count lanes, eight or four at a time where the
+// target has AVX or SSE2, with a scalar loop for whatever is left over.
+inline void Integrate(float *position, const float *velocity, size_t count, float dt) {
+    size_t i = 0;
+#if defined(__AVX__)
+    __m256 dt8 = _mm256_set1_ps(dt);
+    for (; i + 8 <= count; i += 8) {
+        __m256 step = _mm256_mul_ps(_mm256_loadu_ps(velocity + i), dt8);
+        _mm256_storeu_ps(position + i, _mm256_add_ps(_mm256_loadu_ps(position + i), step));
+    }
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128 dt4 = _mm_set1_ps(dt);
+    for (; i + 4 <= count; i += 4) {
+        __m128 step = _mm_mul_ps(_mm_loadu_ps(velocity + i), dt4);
+        _mm_storeu_ps(position + i, _mm_add_ps(_mm_loadu_ps(position + i), step));
+    }
+#endif
+    for (; i < count; i++) {
+        position[i] += velocity[i] * dt;
+    }
+}
+}
+
+namespace Targeting {
+// Where to aim so that a projectile fired now at `speed` meets a target keeping its
+// current velocity: the earliest positive root of |offset + velocity * t| = speed * t.
+// Aims straight at the target when it cannot be caught.
+inline Vector2 LeadAim(Vector2 shooter, Vector2 target, Vector2 targetVelocity, float speed) {
+    Vector2 offset = {target.x - shooter.x, target.y - shooter.y};
+    float a = targetVelocity.x * targetVelocity.x + targetVelocity.y * targetVelocity.y - speed * speed;
+    float b = 2.0f * (offset.x * targetVelocity.x + offset.y * targetVelocity.y);
+    float c = offset.x * offset.x + offset.y * offset.y;
+    float time;
+    if (std::fabs(a) < 1e-6f) {
+        if (b >= 0) return target;
+        time = -c / b;
+    } else {
+        float discriminant = b * b - 4.0f * a * c;
+        if (discriminant < 0) return target;
+        float root = std::sqrt(discriminant);
+        float earlier = (-b - root) / (2.0f * a);
+        float later = (-b + root) / (2.0f * a);
+        if (earlier > later) std::swap(earlier, later);
+        time = earlier > 0 ? earlier : later;
+        if (time <= 0) return target;
+    }
+    return {target.x + targetVelocity.x * time, target.y + targetVelocity.y * time};
+}
+
+// Fills nearest with (squared distance, item) for the k grid items whose points are
+// nearest to point, nearest first. pointsX and pointsY give each item's point by its
+// grid index. The search square doubles until the k-th nearest is known to be inside
+// it. It starts at the size that would hold k items if they were spread evenly, so
+// sparse grids do not pay for a string of near-empty searches first.
+inline void FindNearest(const Collision::UniformGrid &grid, const float *pointsX, const float *pointsY, Vector2 point, int k, uint32_t layerMask, std::vector<std::pair<float, int>> &nearest) {
+    Rectangle bounds = grid.bounds;
+    float startRadius = std::sqrt(k * bounds.width * bounds.height / (PI * std::max(grid.size(), 1)));
+    for (float radius = std::max(grid.cellSize, startRadius);; radius *= 2.0f) {
+        nearest.clear();
+        grid.query({point.x - radius, point.y - radius, 2.0f * radius, 2.0f * radius}, layerMask, [&](int item) {
+            float dx = pointsX[item] - point.x, dy = pointsY[item] - point.y;
+            nearest.push_back({dx * dx + dy * dy, item});
+        });
+        std::sort(nearest.begin(), nearest.end());
+        bool coversGrid = point.x - radius <= bounds.x && point.y - radius <= bounds.y &&
+                          point.x + radius >= bounds.x + bounds.width && point.y + radius >= bounds.y + bounds.height;
+        if (coversGrid) break;
+        // Only the ones inside the circle are certain to beat anything outside the square.
+        size_t numInside = std::lower_bound(nearest.begin(), nearest.end(), std::make_pair(radius * radius, INT32_MAX)) - nearest.begin();
+        if (numInside >= (size_t)k) break;
+    }
+    if (nearest.size() > (size_t)k) nearest.resize(k);
+}
+}
+
+namespace Hashing {
+// 64-bit FNV-1a over raw bytes. Floats are hashed by bit pattern, so two runs only hash
+// the same if they computed exactly the same values.
+class Fnv1a {
+public:
+    uint64_t value = 14695981039346656037ull;
+
+    void add(const void *data, size_t size) {
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++) {
+            value ^= bytes[i];
+            value *= 1099511628211ull;
+        }
+    }
+    template <typename T>
+    void add(const T &item) {
+        add(&item, sizeof(T));
+    }
+    template <typename T>
+    void add(const std::vector<T> &items) {
+        add(items.size());
+        if (!items.empty()) add(items.data(), items.size() * sizeof(T));
+    }
+};
+}
+
+namespace Snapshots {
+// A snapshot is a flat run of bytes built by calling an object's snapshot(stream) with a
+// Writer, and read back by calling the same function with a Reader, so saving and
+// loading share one list of fields and cannot disagree on the layout. Values are stored
+// as raw bytes in the machine's byte order. A vector is its count and then one block
+// copy, so reading into vectors that already have the capacity allocates nothing.
+class Writer {
+public:
+    std::vector<char> bytes;
+
+    void clear() {
+        bytes.clear();
+    }
+    template <typename T>
+    void field(const T &item) {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot fields are copied as raw bytes");
+        write(&item, sizeof(T));
+    }
+    template <typename T>
+    void field(const std::vector<T> &items) {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot fields are copied as raw bytes");
+        field((uint64_t)items.size());
+        write(items.data(), items.size() * sizeof(T));
+    }
+    // For containers of things that are written one field at a time: writes the count
+    // and hands it back, where a Reader reads it.
+    size_t count(size_t count) {
+        field((uint64_t)count);
+        return count;
+    }
+
+private:
+    void write(const void *data, size_t size) {
+        if (size == 0) return;
+        size_t offset = bytes.size();
+        bytes.resize(offset + size);
+        std::memcpy(bytes.data() + offset, data, size);
+    }
+};
+
+// Reads what a Writer wrote. A read past the end, or a count bigger than what is left,
+// leaves the field alone and makes isValid() false, so a truncated or corrupt snapshot
+// can be noticed once the whole object has been read.
+class Reader {
+public:
+    Reader(const char *data, size_t size) {
+        this->data = data;
+        this->size = size;
+    }
+
+    bool isValid() const {
+        return isOk;
+    }
+    bool isAtEnd() const {
+        return offset == size;
+    }
+    template <typename T>
+    void field(T &item) {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot fields are copied as raw bytes");
+        read(&item, sizeof(T));
+    }
+    template <typename T>
+    void field(std::vector<T> &items) {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot fields are copied as raw bytes");
+        uint64_t count = 0;
+        field(count);
+        if (!isOk || count > (size - offset) / std::max<size_t>(sizeof(T), 1)) {
+            isOk = false;
+            return;
+        }
+        items.resize((size_t)count);
+        read(items.data(), items.size() * sizeof(T));
+    }
+    // Every item takes at least a byte, which bounds a corrupt count before anything is resized.
+    size_t count(size_t) {
+        uint64_t count = 0;
+        field(count);
+        if (!isOk || count > size - offset) {
+            isOk = false;
+            return 0;
+        }
+        return (size_t)count;
+    }
+
+private:
+    const char *data;
+    size_t size;
+    size_t offset = 0;
+    bool isOk = true;
+
+    void read(void *item, size_t itemSize) {
+        if (itemSize == 0) return;
+        if (!isOk || itemSize > size - offset) {
+            isOk = false;
+            return;
+        }
+        std::memcpy(item, data + offset, itemSize);
+        offset += itemSize;
+    }
+};
+}
+
+namespace Rewind {
+// The most recent snapshots, kept within a memory budget. Every few entries a keyframe
+// is stored whole; the entries after it are stored as deltas against it: the XOR of the
+// two, which is zero wherever nothing changed, with the zero runs squeezed out. Getting
+// any entry back decodes one delta against its keyframe. Over budget, the oldest
+// keyframe goes along with all of its deltas.
+class History {
+public:
+    size_t budgetBytes;
+    int keyframeInterval;
+
+    History(size_t budgetBytes, int keyframeInterval) {
+        this->budgetBytes = budgetBytes;
+        this->keyframeInterval = keyframeInterval;
+    }
+
+    void record(const std::vector<char> &snapshot) {
+        // A delta that saves less than half is not worth decoding, so its entry starts a
+        // new keyframe instead, which is what happens once lots of things have spawned.
+        if (segments.empty() || segments.back().size() >= (size_t)keyframeInterval || segments.back().lastDeltaSize() > snapshot.size() / 2) {
+            startSegment(snapshot);
+        } else {
+            Segment &segment = segments.back();
+            numBytes -= segment.getNumBytes();
+            encode(segment.keyframe, snapshot, segment.deltas);
+            segment.deltaEnds.push_back(segment.deltas.size());
+            segment.rawSizes.push_back(snapshot.size());
+            numBytes += segment.getNumBytes();
+        }
+        numEntries++;
+        numRawBytes += snapshot.size();
+        while (numBytes > budgetBytes && segments.size() > 1) {
+            dropOldestSegment();
+        }
+    }
+    // Entry 0 is the oldest one still kept.
+    bool get(size_t index, std::vector<char> &snapshot) const {
+        for (const Segment &segment: segments) {
+            if (index >= segment.size()) {
+                index -= segment.size();
+                continue;
+            }
+            if (index == 0) {
+                snapshot = segment.keyframe;
+                return true;
+            }
+            size_t begin = index == 1 ? 0 : segment.deltaEnds[index - 2];
+            return decode(segment.keyframe, segment.deltas.data() + begin, segment.deltaEnds[index - 1] - begin, snapshot);
+        }
+        return false;
+    }
+    // Keeps the oldest numKept entries, for carrying on from one of them.
+    void truncate(size_t numKept) {
+        while (numEntries > numKept) {
+            Segment &segment = segments.back();
+            numEntries--;
+            numRawBytes -= segment.rawSizes.back();
+            numBytes -= segment.getNumBytes();
+            if (segment.size() == 1) {
+                recycle(std::move(segment));
+                segments.pop_back();
+                continue;
+            }
+            segment.deltaEnds.pop_back();
+            segment.rawSizes.pop_back();
+            segment.deltas.resize(segment.deltaEnds.empty() ? 0 : segment.deltaEnds.back());
+            numBytes += segment.getNumBytes();
+        }
+    }
+    void clear() {
+        truncate(0);
+    }
+    size_t size() const {
+        return numEntries;
+    }
+    // What the kept entries take up, and what they would if each were stored whole.
+    size_t getNumBytes() const {
+        return numBytes;
+    }
+    size_t getNumRawBytes() const {
+        return numRawBytes;
+    }
+
+private:
+    struct Segment {
+        std::vector<char> keyframe;
+        std::vector<char> deltas;
+        std::vector<size_t> deltaEnds;
+        std::vector<size_t> rawSizes;
+
+        size_t size() const {
+            return rawSizes.size();
+        }
+        size_t lastDeltaSize() const {
+            if (deltaEnds.empty()) return 0;
+            return deltaEnds.back() - (deltaEnds.size() == 1 ? 0 : deltaEnds[deltaEnds.size() - 2]);
+        }
+        size_t getNumBytes() const {
+            return keyframe.size() + deltas.size() + deltaEnds.size() * sizeof(size_t) + rawSizes.size() * sizeof(size_t);
+        }
+    };
+    // Zero runs shorter than this cost more to mark than to store.
+    static constexpr size_t MIN_ZERO_RUN = sizeof(uint32_t);
+
+    std::deque<Segment> segments;
+    // A dropped segment's buffers are reused by the next keyframe, so once the budget is
+    // reached recording settles into no allocations.
+    std::vector<Segment> spareSegments;
+    size_t numEntries = 0;
+    size_t numBytes = 0;
+    size_t numRawBytes = 0;
+
+    void startSegment(const std::vector<char> &snapshot) {
+        Segment segment;
+        if (!spareSegments.empty()) {
+            segment = std::move(spareSegments.back());
+            spareSegments.pop_back();
+        }
+        segment.keyframe.assign(snapshot.begin(), snapshot.end());
+        segment.deltas.clear();
+        segment.deltaEnds.clear();
+        segment.rawSizes.assign(1, snapshot.size());
+        numBytes += segment.getNumBytes();
+        segments.push_back(std::move(segment));
+    }
+    void dropOldestSegment() {
+        Segment &segment = segments.front();
+        numEntries -= segment.size();
+        numBytes -= segment.getNumBytes();
+        for (size_t rawSize: segment.rawSizes) numRawBytes -= rawSize;
+        recycle(std::move(segment));
+        segments.pop_front();
+    }
+    void recycle(Segment &&segment) {
+        if (spareSegments.empty()) spareSegments.push_back(std::move(segment));
+    }
+
+    // A delta is the snapshot's size, then pairs of a zero run to skip and a run of XORed
+    // bytes, as varints. Past the end of the keyframe the keyframe counts as zeros.
+    static void encode(const std::vector<char> &keyframe, const std::vector<char> &snapshot, std::vector<char> &delta) {
+        const char *base = keyframe.data();
+        const char *next = snapshot.data();
+        size_t size = snapshot.size();
+        size_t common = std::min(keyframe.size(), size);
+        auto isSame = [&](size_t i) {
+            return (i < common ? base[i] : 0) == next[i];
+        };
+        size_t start = delta.size();
+        delta.resize(start + sizeof(uint64_t));
+        uint64_t size64 = size;
+        std::memcpy(delta.data() + start, &size64, sizeof(uint64_t));
+        size_t i = 0;
+        while (i < size) {
+            size_t zeroStart = i;
+            for (uint64_t a, b; i + sizeof(uint64_t) <= common; i += sizeof(uint64_t)) {
+                std::memcpy(&a, base + i, sizeof(uint64_t));
+                std::memcpy(&b, next + i, sizeof(uint64_t));
+                if (a != b) break;
+            }
+            while (i < size && isSame(i)) i++;
+            if (i == size) break;
+            size_t zeroRun = i - zeroStart;
+            size_t literalStart = i;
+            // Steps a word at a time, so a zero run is only noticed from where a word
+            // starts: one of MIN_ZERO_RUN * 2 - 1 bytes always is.
+            for (uint32_t a, b; i + MIN_ZERO_RUN <= common; i += MIN_ZERO_RUN) {
+                std::memcpy(&a, base + i, MIN_ZERO_RUN);
+                std::memcpy(&b, next + i, MIN_ZERO_RUN);
+                if (a == b) break;
+            }
+            if (i + MIN_ZERO_RUN > common) {
+                size_t sameRun = 0;
+                for (; i < size && sameRun < MIN_ZERO_RUN; i++) {
+                    sameRun = isSame(i) ? sameRun + 1 : 0;
+                }
+                if (sameRun == MIN_ZERO_RUN) i -= sameRun;
+            }
+            writeVarint(delta, zeroRun);
+            writeVarint(delta, i - literalStart);
+            size_t offset = delta.size();
+            delta.resize(offset + i - literalStart);
+            char *literal = delta.data() + offset;
+            size_t literalCommon = std::max(literalStart, std::min(i, common));
+            for (size_t j = literalStart; j < literalCommon; j++) literal[j - literalStart] = base[j] ^ next[j];
+            for (size_t j = literalCommon; j < i; j++) literal[j - literalStart] = next[j];
+        }
+    }
+    static bool decode(const std::vector<char> &keyframe, const char *delta, size_t deltaSize, std::vector<char> &snapshot) {
+        uint64_t size;
+        if (deltaSize < sizeof(uint64_t)) return false;
+        std::memcpy(&size, delta, sizeof(uint64_t));
+        snapshot.assign(keyframe.begin(), keyframe.begin() + std::min<size_t>(keyframe.size(), size));
+        snapshot.resize(size, 0);
+        size_t offset = sizeof(uint64_t);
+        size_t i = 0;
+        while (offset < deltaSize) {
+            uint64_t zeroRun, literalSize;
+            if (!readVarint(delta, deltaSize, offset, zeroRun) || !readVarint(delta, deltaSize, offset, literalSize)) return false;
+            if (zeroRun > size - i || literalSize > size - i - zeroRun || literalSize > deltaSize - offset) return false;
+            i += zeroRun;
+            for (uint64_t j = 0; j < literalSize; j++) {
+                snapshot[i++] ^= delta[offset++];
+            }
+        }
+        return true;
+    }
+    static void writeVarint(std::vector<char> &bytes, uint64_t value) {
+        do {
+            uint8_t byte = value & 0x7f;
+            value >>= 7;
+            bytes.push_back(static_cast<char>(value != 0 ? byte | 0x80 : byte));
+        } while (value != 0);
+    }
+    static bool readVarint(const char *bytes, size_t size, size_t &offset, uint64_t &value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (offset >= size) return false;
+            uint8_t byte = static_cast<uint8_t>(bytes[offset++]);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if ((byte & 0x80) == 0) return true;
+        }
+        return false;
+    }
+};
 }
+
+namespace Random {
+// xoshiro128** by Blackman and Vigna: 16 bytes of state, a few cycles per number. Each
+// engine is its own stream with no global state, so subsystems and threads can each own
+// one and stay reproducible regardless of what the others draw.
+class Xoshiro128 {
+public:
+    uint32_t state[4];
+
+    Xoshiro128(uint64_t seed = 0, uint64_t stream = 0) {
+        this->seed(seed, stream);
+    }
+
+    // Expands (seed, stream) with splitmix64, so nearby seeds and streams start far apart.
+    void seed(uint64_t seed, uint64_t stream = 0) {
+        uint64_t x = seed ^ (stream * 0xd1b54a32d192ed03ull);
+        for (int i = 0; i < 4; i += 2) {
+            uint64_t z = (x += 0x9e3779b97f4a7c15ull);
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+            z ^= z >> 31;
+            state[i] = (uint32_t)z;
+            state[i + 1] = (uint32_t)(z >> 32);
+        }
+        if ((state[0] | state[1] | state[2] | state[3]) == 0) state[0] = 1;
+    }
+    uint32_t next() {
+        uint32_t result = rotateLeft(state[1] * 5, 7) * 9;
+        uint32_t t = state[1] << 9;
+        state[2] ^= state[0];
+        state[3] ^= state[1];
+        state[1] ^= state[2];
+        state[0] ^= state[3];
+        state[2] ^= t;
+        state[3] = rotateLeft(state[3], 11);
+        return result;
+    }
+    // In [0, 1), using all 24 bits a float can hold.
+    float nextFloat() {
+        return (next() >> 8) * (1.0f / 16777216.0f);
+    }
+    float uniform(float min, float max) {
+        return min + nextFloat() * (max - min);
+    }
+    // In [min, max], without modulo bias (Lemire's multiply-and-reject).
+    int uniformInt(int min, int max) {
+        uint32_t range = (uint32_t)max - (uint32_t)min + 1;
+        if (range == 0) return (int)next();
+        uint64_t product = (uint64_t)next() * range;
+        if ((uint32_t)product < range) {
+            uint32_t threshold = (0u - range) % range;
+            while ((uint32_t)product < threshold) product = (uint64_t)next() * range;
+        }
+        return min + (int)(product >> 32);
+    }
+    bool nextBool() {
+        return next() >> 31;
+    }
+    // A batch of floats in [0, 1), for spawning many things in one go.
+    void fill(float *out, size_t count) {
+        for (size_t i = 0; i < count; i++) out[i] = nextFloat();
+    }
+
+private:
+    static uint32_t rotateLeft(uint32_t x, int k) {
+        return (x << k) | (x >> (32 - k));
+    }
+};
 }
 
 namespace Textures {
@@ -96,6 +781,454 @@ inline Texture2D LoadTextureFromMemory(const char *fileType, const unsigned char
     UnloadImage(image);
     return texture;
 }
+
+// Shelf packer: tallest rectangles first, left to right in rows of the given width.
+// Returns where each size goes, in input order, and the total height used.
+inline std::vector<Rectangle> PackShelves(const std::vector<Vector2> &sizes, int width, int padding, int &height) {
+    std::vector<int> order(sizes.size());
+    for (size_t i = 0; i < order.size(); i++) order[i] = (int)i;
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return sizes[a].y > sizes[b].y; });
+
+    std::vector<Rectangle> regions(sizes.size());
+    float x = 0, y = 0, shelfHeight = 0;
+    for (int i: order) {
+        if (x + sizes[i].x > width && x > 0) {
+            x = 0;
+            y += shelfHeight + padding;
+            shelfHeight = 0;
+        }
+        regions[i] = {x, y, sizes[i].x, sizes[i].y};
+        x += sizes[i].x + padding;
+        shelfHeight = std::max(shelfHeight, sizes[i].y);
+    }
+    height = (int)(y + shelfHeight);
+    return regions;
+}
+}
+
+namespace Text {
+struct Glyph {
+    Rectangle source;
+    Rectangle dest; // relative to where the run is drawn
+};
+struct GlyphRun {
+    std::vector<Glyph> glyphs;
+    Vector2 size;
+};
+
+// Same layout as DrawTextEx for a single line, done once so it can be redrawn many times.
+inline GlyphRun LayoutGlyphRun(const Font &font, const char *text, float fontSize, float spacing) {
+    GlyphRun run = {{}, {0, fontSize}};
+    float scaleFactor = fontSize / font.baseSize;
+    float padding = (float)font.glyphPadding;
+    float offsetX = 0;
+    for (const char *c = text; *c != '\0'; c++) {
+        int index = GetGlyphIndex(font, *c);
+        const Rectangle &rec = font.recs[index];
+        const GlyphInfo &info = font.glyphs[index];
+        if (*c != ' ' && *c != '\t') {
+            Rectangle source = {rec.x - padding, rec.y - padding, rec.width + 2 * padding, rec.height + 2 * padding};
+            Rectangle dest = {offsetX + (info.offsetX - padding) * scaleFactor, (info.offsetY - padding) * scaleFactor,
+                              source.width * scaleFactor, source.height * scaleFactor};
+            run.glyphs.push_back({source, dest});
+        }
+        offsetX += (info.advanceX == 0 ? rec.width : info.advanceX) * scaleFactor + spacing;
+    }
+    run.size.x = std::max(0.0f, offsetX - spacing);
+    return run;
+}
+
+inline void DrawGlyphRun(const Font &font, const GlyphRun &run, Vector2 position, Color tint) {
+    for (const Glyph &glyph: run.glyphs) {
+        Rectangle dest = {position.x + glyph.dest.x, position.y + glyph.dest.y, glyph.dest.width, glyph.dest.height};
+        DrawTexturePro(font.texture, glyph.source, dest, {0, 0}, 0, tint);
+    }
+}
+
+// Laid-out runs for "<format> applied to an integer", keyed by the format string, the value
+// and the size, so a label is only formatted and laid out again when its number changes.
+// Format strings are expected to be literals: they are keyed by address.
+class GlyphRunCache {
+public:
+    size_t maxRuns;
+    long numHits = 0;
+    long numMisses = 0;
+
+    GlyphRunCache(size_t maxRuns = 1024) {
+        this->maxRuns = maxRuns;
+    }
+
+    const GlyphRun &get(const Font &font, const char *format, int value, float fontSize, float spacing) {
+        Key key = {format, value, fontSize, spacing};
+        auto it = runs.find(key);
+        if (it != runs.end()) {
+            numHits++;
+            return it->second;
+        }
+        numMisses++;
+        // Counters like nutrition only ever grow, so old entries are rarely needed again.
+        if (runs.size() >= maxRuns) runs.clear();
+        char text[64];
+        snprintf(text, sizeof(text), format, value);
+        return runs.emplace(key, LayoutGlyphRun(font, text, fontSize, spacing)).first->second;
+    }
+    void draw(const Font &font, const char *format, int value, Vector2 position, float fontSize, float spacing, Color tint) {
+        DrawGlyphRun(font, get(font, format, value, fontSize, spacing), position, tint);
+    }
+    // Must be called if the font is reloaded.
+    void clear() {
+        runs.clear();
+    }
+
+private:
+    struct Key {
+        const char *format;
+        int value;
+        float fontSize;
+        float spacing;
+        bool operator==(const Key &other) const {
+            return format == other.format && value == other.value && fontSize == other.fontSize && spacing == other.spacing;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            uint32_t sizeBits, spacingBits;
+            std::memcpy(&sizeBits, &key.fontSize, sizeof(sizeBits));
+            std::memcpy(&spacingBits, &key.spacing, sizeof(spacingBits));
+            size_t hash = std::hash<const void *>()(key.format);
+            hash = hash * 31 + std::hash<int>()(key.value);
+            hash = hash * 31 + sizeBits;
+            return hash * 31 + spacingBits;
+        }
+    };
+    std::unordered_map<Key, GlyphRun, KeyHash> runs;
+};
+}
+
+// One file holding assets already decoded into what raylib uploads: RGBA pixels, PCM
+// samples and baked font atlases. Files are an entry table followed by the data blobs,
+// each aligned to ALIGNMENT, and are read in place through a memory mapping.
+namespace AssetPack {
+constexpr uint32_t MAGIC = 0x4b504646; // "FFPK"
+constexpr uint32_t VERSION = 1;
+constexpr uint64_t ALIGNMENT = 64;
+
+enum class EntryType : uint32_t {
+    IMAGE, // params: width, height, pixel format. May have no data if only the size is needed.
+    WAVE,  // params: frame count, sample rate, sample size, channels
+    FONT,  // params: base size, glyph count, glyph padding, atlas width, atlas height, atlas format
+    FILE,  // the original file bytes, for things that stay encoded such as streamed music
+};
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t numEntries;
+    uint32_t reserved;
+};
+struct Entry {
+    char name[64];
+    EntryType type;
+    int32_t params[7];
+    uint64_t offset;
+    uint64_t size;
+};
+// Font data is glyphCount of these followed, at the next aligned offset, by the atlas pixels.
+struct PackedGlyph {
+    int32_t value;
+    int32_t offsetX;
+    int32_t offsetY;
+    int32_t advanceX;
+    Rectangle rec;
+};
+
+inline uint64_t AlignUp(uint64_t offset) {
+    return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+class Writer {
+public:
+    std::vector<Entry> entries;
+
+    void add(const char *name, EntryType type, std::array<int32_t, 7> params, const void *data, uint64_t size) {
+        Entry entry = {};
+        strncpy(entry.name, name, sizeof(entry.name) - 1);
+        entry.type = type;
+        std::copy(params.begin(), params.end(), entry.params);
+        payload.resize(AlignUp(payload.size()));
+        entry.offset = payload.size();
+        entry.size = size;
+        const unsigned char *bytes = static_cast<const unsigned char *>(data);
+        if (size > 0) payload.insert(payload.end(), bytes, bytes + size);
+        entries.push_back(entry);
+    }
+    void addImage(const char *name, Image image, bool shouldStorePixels = true) {
+        uint64_t size = shouldStorePixels ? GetPixelDataSize(image.width, image.height, image.format) : 0;
+        add(name, EntryType::IMAGE, {image.width, image.height, image.format}, image.data, size);
+    }
+    void addWave(const char *name, Wave wave) {
+        uint64_t size = (uint64_t)wave.frameCount * wave.channels * wave.sampleSize / 8;
+        add(name, EntryType::WAVE, {(int32_t)wave.frameCount, (int32_t)wave.sampleRate, (int32_t)wave.sampleSize, (int32_t)wave.channels}, wave.data, size);
+    }
+    void addFont(const char *name, int baseSize, int glyphPadding, const GlyphInfo *glyphs, const Rectangle *recs, int glyphCount, Image atlas) {
+        std::vector<unsigned char> data(AlignUp(glyphCount * sizeof(PackedGlyph)));
+        for (int i = 0; i < glyphCount; i++) {
+            PackedGlyph glyph = {glyphs[i].value, glyphs[i].offsetX, glyphs[i].offsetY, glyphs[i].advanceX, recs[i]};
+            std::memcpy(data.data() + i * sizeof(PackedGlyph), &glyph, sizeof(glyph));
+        }
+        const unsigned char *pixels = static_cast<const unsigned char *>(atlas.data);
+        data.insert(data.end(), pixels, pixels + GetPixelDataSize(atlas.width, atlas.height, atlas.format));
+        add(name, EntryType::FONT, {baseSize, glyphCount, glyphPadding, atlas.width, atlas.height, atlas.format}, data.data(), data.size());
+    }
+    void addFile(const char *name, const unsigned char *data, int size) {
+        add(name, EntryType::FILE, {}, data, size);
+    }
+    bool save(const char *fileName) const {
+        Header header = {MAGIC, VERSION, (uint32_t)entries.size(), 0};
+        uint64_t payloadStart = AlignUp(sizeof(Header) + entries.size() * sizeof(Entry));
+        std::vector<Entry> table = entries;
+        for (Entry &entry: table) entry.offset += payloadStart;
+
+        std::ofstream file(fileName, std::ios::binary);
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(Entry));
+        std::vector<char> padding(payloadStart - sizeof(Header) - table.size() * sizeof(Entry), 0);
+        file.write(padding.data(), padding.size());
+        file.write(reinterpret_cast<const char *>(payload.data()), payload.size());
+        return file.good();
+    }
+
+private:
+    std::vector<unsigned char> payload;
+};
+
+// Read-only view of a whole file. Everything built from a Reader points into this
+// memory, so it has to outlive those assets.
+class MappedFile {
+public:
+    const unsigned char *data = nullptr;
+    uint64_t size = 0;
+
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile() {
+        close();
+    }
+
+    bool open(const char *fileName) {
+        close();
+#if defined(_WIN32)
+        HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER fileSize;
+        HANDLE mapping = nullptr;
+        if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0) {
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        }
+        CloseHandle(file);
+        if (mapping == nullptr) return false;
+        data = static_cast<const unsigned char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        CloseHandle(mapping);
+        if (data == nullptr) return false;
+        size = fileSize.QuadPart;
+#else
+        int file = ::open(fileName, O_RDONLY);
+        if (file < 0) return false;
+        struct stat fileStat;
+        void *mapping = MAP_FAILED;
+        if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0) {
+            mapping = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        }
+        ::close(file);
+        if (mapping == MAP_FAILED) return false;
+        data = static_cast<const unsigned char *>(mapping);
+        size = fileStat.st_size;
+#endif
+        return true;
+    }
+    void close() {
+        if (data == nullptr) return;
+#if defined(_WIN32)
+        UnmapViewOfFile(data);
+#else
+        munmap(const_cast<unsigned char *>(data), size);
+#endif
+        data = nullptr;
+        size = 0;
+    }
+};
+
+class Reader {
+public:
+    MappedFile file;
+
+    bool open(const char *fileName) {
+        if (!file.open(fileName)) return false;
+        if (file.size < sizeof(Header)) return fail();
+        const Header *header = reinterpret_cast<const Header *>(file.data);
+        if (header->magic != MAGIC || header->version != VERSION) return fail();
+        if (sizeof(Header) + (uint64_t)header->numEntries * sizeof(Entry) > file.size) return fail();
+        const Entry *table = reinterpret_cast<const Entry *>(file.data + sizeof(Header));
+        entries.assign(table, table + header->numEntries);
+        for (const Entry &entry: entries) {
+            if (entry.offset + entry.size > file.size || entry.name[sizeof(entry.name) - 1] != '\0') return fail();
+        }
+        return true;
+    }
+    const Entry *find(const char *name, EntryType type) const {
+        for (const Entry &entry: entries) {
+            if (entry.type == type && strcmp(entry.name, name) == 0) return &entry;
+        }
+        return nullptr;
+    }
+    const unsigned char *getData(const Entry &entry) const {
+        return file.data + entry.offset;
+    }
+    // The returned image and wave point into the mapping: upload them, never unload them.
+    Image getImage(const Entry &entry) const {
+        return {(void *)getData(entry), entry.params[0], entry.params[1], 1, entry.params[2]};
+    }
+    Wave getWave(const Entry &entry) const {
+        return {(unsigned int)entry.params[0], (unsigned int)entry.params[1], (unsigned int)entry.params[2], (unsigned int)entry.params[3], (void *)getData(entry)};
+    }
+    Font loadFont(const Entry &entry) const {
+        Font font = {};
+        font.baseSize = entry.params[0];
+        font.glyphCount = entry.params[1];
+        font.glyphPadding = entry.params[2];
+        font.glyphs = static_cast<GlyphInfo *>(MemAlloc(font.glyphCount * sizeof(GlyphInfo)));
+        font.recs = static_cast<Rectangle *>(MemAlloc(font.glyphCount * sizeof(Rectangle)));
+        const unsigned char *data = getData(entry);
+        for (int i = 0; i < font.glyphCount; i++) {
+            PackedGlyph glyph;
+            std::memcpy(&glyph, data + i * sizeof(PackedGlyph), sizeof(glyph));
+            font.glyphs[i] = {glyph.value, glyph.offsetX, glyph.offsetY, glyph.advanceX, {}};
+            font.recs[i] = glyph.rec;
+        }
+        Image atlas = {(void *)(data + AlignUp(font.glyphCount * sizeof(PackedGlyph))), entry.params[3], entry.params[4], 1, entry.params[5]};
+        font.texture = LoadTextureFromImage(atlas);
+        return font;
+    }
+
+private:
+    std::vector<Entry> entries;
+
+    bool fail() {
+        entries.clear();
+        file.close();
+        return false;
+    }
+};
+}
+
+namespace Queues {
+// Lock-free ring buffer for exactly one producer thread and one consumer thread.
+// Capacity must be a power of two.
+template <typename T, size_t Capacity>
+class SpscRing {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    bool push(const T &item) {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail - head.load(std::memory_order_acquire) == Capacity) return false;
+        items[tail & (Capacity - 1)] = item;
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    bool pop(T &item) {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        if (head == tail.load(std::memory_order_acquire)) return false;
+        item = items[head & (Capacity - 1)];
+        this->head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    size_t size() const {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<T, Capacity> items;
+    // On separate cache lines so the two threads do not keep stealing each other's line.
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+};
+}
+
+namespace Loading {
+// Runs each job's decode step on worker threads and its upload step on the thread that
+// calls uploadDecoded(), for work like image decoding that can happen anywhere followed
+// by a GPU or audio device upload that has to happen on the main thread.
+class ParallelLoader {
+public:
+    struct Job {
+        std::string name;
+        std::function<void()> decode;
+        std::function<void()> upload;
+        std::atomic<bool> isDecoded{false};
+        double decodeMilliseconds = 0;
+        double uploadMilliseconds = 0;
+    };
+    std::vector<std::unique_ptr<Job>> jobs;
+
+    ParallelLoader() = default;
+    ParallelLoader(const ParallelLoader &) = delete;
+    ParallelLoader &operator=(const ParallelLoader &) = delete;
+    ~ParallelLoader() {
+        join();
+    }
+
+    // Jobs are handed out in the order they are added, so add the ones needed first first.
+    void add(const std::string &name, std::function<void()> decode, std::function<void()> upload) {
+        std::unique_ptr<Job> job = std::make_unique<Job>();
+        job->name = name;
+        job->decode = std::move(decode);
+        job->upload = std::move(upload);
+        jobs.push_back(std::move(job));
+    }
+    void start(int numThreads) {
+        for (int i = 0; i < std::max(1, numThreads); i++) {
+            workers.emplace_back([this]() {
+                for (size_t i = nextJob++; i < jobs.size(); i = nextJob++) {
+                    auto startTime = std::chrono::steady_clock::now();
+                    if (jobs[i]->decode) jobs[i]->decode();
+                    jobs[i]->decodeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+                    jobs[i]->isDecoded.store(true, std::memory_order_release);
+                }
+            });
+        }
+    }
+    // Uploads every job that has finished decoding, in order. Returns true once all are done.
+    bool uploadDecoded() {
+        while (numUploaded < jobs.size() && jobs[numUploaded]->isDecoded.load(std::memory_order_acquire)) {
+            Job &job = *jobs[numUploaded];
+            auto startTime = std::chrono::steady_clock::now();
+            if (job.upload) job.upload();
+            job.uploadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
+            numUploaded++;
+        }
+        if (numUploaded < jobs.size()) return false;
+        join();
+        return true;
+    }
+    float getProgress() const {
+        if (jobs.empty()) return 1;
+        size_t numDecoded = 0;
+        for (const auto &job: jobs) numDecoded += job->isDecoded.load(std::memory_order_relaxed);
+        return (numDecoded + numUploaded) / (2.0f * jobs.size());
+    }
+
+private:
+    std::atomic<size_t> nextJob{0};
+    size_t numUploaded = 0;
+    std::vector<std::thread> workers;
+
+    void join() {
+        for (std::thread &worker: workers) worker.join();
+        workers.clear();
+    }
+};
 }
 
 namespace Sounds {
@@ -105,37 +1238,786 @@ inline Sound LoadSoundFromMemory(const char *fileType, const unsigned char *file
     UnloadWave(wave);
     return sound;
 }
+
+// Owns a set of music streams and keeps them fed from its own thread, so a long frame
+// cannot starve them and refilling them costs the frame nothing. The game only sends
+// commands; after start() it must not touch the streams itself.
+class MusicThread {
+public:
+    enum class CommandType : uint8_t {
+        CROSSFADE, // fade track in, and every other track out, over the given seconds. -1 fades all out.
+        PAUSE,
+        RESUME,
+    };
+    struct Command {
+        CommandType type;
+        int track;
+        float seconds;
+    };
+
+    MusicThread() = default;
+    MusicThread(const MusicThread &) = delete;
+    MusicThread &operator=(const MusicThread &) = delete;
+    ~MusicThread() {
+        stop();
+    }
+
+    void start(const std::vector<Music> &musicStreams, int updateMilliseconds = 5) {
+        stop();
+        tracks.clear();
+        for (const Music &music: musicStreams) {
+            tracks.push_back({music});
+        }
+        isRunning = true;
+        thread = std::thread([this, updateMilliseconds]() { run(updateMilliseconds); });
+    }
+    // Returns false if the queue is full, in which case the command should be sent again later.
+    bool send(Command command) {
+        return commands.push(command);
+    }
+    void stop() {
+        if (!thread.joinable()) return;
+        isRunning = false;
+        thread.join();
+        for (Track &track: tracks) StopMusicStream(track.music);
+    }
+
+private:
+    struct Track {
+        Music music;
+        float volume = 0;
+        float targetVolume = 0;
+        float fadeSpeed = 0;
+        bool hasStarted = false;
+        bool isPlaying = false;
+    };
+    std::vector<Track> tracks;
+    Queues::SpscRing<Command, 64> commands;
+    std::atomic<bool> isRunning{false};
+    bool isPaused = false;
+    std::thread thread;
+
+    void run(int updateMilliseconds) {
+        auto lastTime = std::chrono::steady_clock::now();
+        while (isRunning) {
+            Command command;
+            while (commands.pop(command)) apply(command);
+            auto time = std::chrono::steady_clock::now();
+            float dt = std::chrono::duration<float>(time - lastTime).count();
+            lastTime = time;
+            if (!isPaused) {
+                for (Track &track: tracks) {
+                    if (!track.isPlaying) continue;
+                    fade(track, dt);
+                    UpdateMusicStream(track.music);
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(updateMilliseconds));
+        }
+    }
+    void apply(const Command &command) {
+        switch (command.type) {
+            case CommandType::CROSSFADE:
+                for (int i = 0; i < (int)tracks.size(); i++) {
+                    Track &track = tracks[i];
+                    track.targetVolume = i == command.track ? 1.0f : 0.0f;
+                    track.fadeSpeed = command.seconds > 0 ? 1.0f / command.seconds : INFINITY;
+                    if (i != command.track || track.isPlaying) continue;
+                    if (track.hasStarted) {
+                        ResumeMusicStream(track.music);
+                    } else {
+                        PlayMusicStream(track.music);
+                    }
+                    track.hasStarted = true;
+                    track.isPlaying = true;
+                    SetMusicVolume(track.music, track.volume);
+                }
+                break;
+            case CommandType::PAUSE:
+                if (isPaused) break;
+                isPaused = true;
+                for (Track &track: tracks) {
+                    if (track.isPlaying) PauseMusicStream(track.music);
+                }
+                break;
+            case CommandType::RESUME:
+                if (!isPaused) break;
+                isPaused = false;
+                for (Track &track: tracks) {
+                    if (track.isPlaying) ResumeMusicStream(track.music);
+                }
+                break;
+        }
+    }
+    // A track that has faded all the way out is paused, so it resumes where it left off.
+    void fade(Track &track, float dt) {
+        if (track.volume == track.targetVolume) return;
+        float step = track.fadeSpeed * dt;
+        if (track.volume < track.targetVolume) {
+            track.volume = std::min(track.targetVolume, track.volume + step);
+        } else {
+            track.volume = std::max(track.targetVolume, track.volume - step);
+        }
+        SetMusicVolume(track.music, track.volume);
+        if (track.volume == 0) {
+            PauseMusicStream(track.music);
+            track.isPlaying = false;
+        }
+    }
+};
+
+// Plays a fixed set of sounds through a bounded number of voices. Triggers are counted
+// with trigger() and play() turns them into at most one PlaySound per sound, so a volley
+// of the same sound costs one voice instead of restarting a buffer over and over. Each
+// sound gets its own few aliases of one buffer; when maxVoices are already playing, the
+// lowest priority, oldest voice is stopped for a new one of equal or higher priority,
+// otherwise the new one is dropped.
+class VoicePool {
+public:
+    int maxVoices;
+    int voicesPerSound;
+    long numTriggers = 0;
+    long numPlays = 0;
+    long numStolen = 0;
+    long numCulled = 0;
+
+    VoicePool(int maxVoices, int voicesPerSound) {
+        this->maxVoices = maxVoices;
+        this->voicesPerSound = voicesPerSound;
+    }
+
+    int addSound(Sound source, int priority) {
+        int soundIndex = (int)pendingTriggers.size();
+        for (int i = 0; i < voicesPerSound; i++) {
+            voices.push_back({LoadSoundAlias(source), soundIndex, priority, 0});
+        }
+        pendingTriggers.push_back(0);
+        priorities.push_back(priority);
+        playOrder.push_back(soundIndex);
+        std::stable_sort(playOrder.begin(), playOrder.end(), [&](int a, int b) { return priorities[a] > priorities[b]; });
+        return soundIndex;
+    }
+    void trigger(int soundIndex) {
+        pendingTriggers[soundIndex]++;
+        numTriggers++;
+    }
+    // Once per frame, after the frame's triggers.
+    void play() {
+        int numPlaying = 0;
+        for (Voice &voice: voices) {
+            voice.isPlaying = IsSoundPlaying(voice.alias);
+            numPlaying += voice.isPlaying;
+        }
+        for (int soundIndex: playOrder) {
+            if (pendingTriggers[soundIndex] == 0) continue;
+            pendingTriggers[soundIndex] = 0;
+            Voice *voice = findVoice(soundIndex);
+            if (!voice->isPlaying && numPlaying >= maxVoices) {
+                Voice *victim = findVictim(priorities[soundIndex]);
+                if (victim == nullptr) {
+                    numCulled++;
+                    continue;
+                }
+                StopSound(victim->alias);
+                victim->isPlaying = false;
+                numStolen++;
+                numPlaying--;
+            }
+            if (voice->isPlaying) {
+                numStolen++;
+            } else {
+                numPlaying++;
+            }
+            PlaySound(voice->alias);
+            voice->isPlaying = true;
+            voice->startedAt = ++playCounter;
+            numPlays++;
+        }
+    }
+    void unload() {
+        for (Voice &voice: voices) UnloadSoundAlias(voice.alias);
+        voices.clear();
+        pendingTriggers.clear();
+        priorities.clear();
+        playOrder.clear();
+    }
+
+private:
+    struct Voice {
+        Sound alias;
+        int soundIndex;
+        int priority;
+        uint64_t startedAt;
+        bool isPlaying = false;
+    };
+    std::vector<Voice> voices;
+    std::vector<int> pendingTriggers;
+    std::vector<int> priorities;
+    std::vector<int> playOrder;
+    uint64_t playCounter = 0;
+
+    // An idle alias of the sound, or else its oldest one, which gets restarted.
+    Voice *findVoice(int soundIndex) {
+        Voice *oldest = nullptr;
+        for (int i = soundIndex * voicesPerSound; i < (soundIndex + 1) * voicesPerSound; i++) {
+            if (!voices[i].isPlaying) return &voices[i];
+            if (oldest == nullptr || voices[i].startedAt < oldest->startedAt) oldest = &voices[i];
+        }
+        return oldest;
+    }
+    Voice *findVictim(int priority) {
+        Voice *victim = nullptr;
+        for (Voice &voice: voices) {
+            if (!voice.isPlaying || voice.priority > priority) continue;
+            if (victim == nullptr || voice.priority < victim->priority || (voice.priority == victim->priority && voice.startedAt < victim->startedAt)) {
+                victim = &voice;
+            }
+        }
+        return victim;
+    }
+};
 }
 
-namespace Timers {
-class Timer {
+namespace Jobs {
+// A fixed set of threads that share out the chunks of a loop. Each thread has its own
+// deque of chunks: it works through its own from the front and, once that is empty,
+// steals from the back of another's, so a thread that finishes early helps whoever is
+// behind. The thread calling parallelFor() is thread 0 and works too, which means
+// numThreads = 1 runs everything inline with no threads at all.
+class JobSystem {
+public:
+    std::atomic<long> numSteals = 0;
+
+    JobSystem(int numThreads) {
+        this->numThreads = std::max(1, numThreads);
+        for (int i = 0; i < this->numThreads; i++) {
+            queues.push_back(std::make_unique<WorkerQueue>());
+        }
+        for (int i = 1; i < this->numThreads; i++) {
+            threads.emplace_back([this, i] { runWorker(i); });
+        }
+    }
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            isStopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &thread: threads) thread.join();
+    }
+    JobSystem(const JobSystem &) = delete;
+    JobSystem &operator=(const JobSystem &) = delete;
+
+    int getNumThreads() const {
+        return numThreads;
+    }
+    static size_t getNumChunks(size_t count, size_t grainSize) {
+        return (count + grainSize - 1) / grainSize;
+    }
+    // Calls run(chunk, begin, end) for [0, count) in chunks of grainSize items and returns
+    // once every chunk has finished. Chunk numbers count up from 0 with begin and do not
+    // depend on which thread ran them, so output kept per chunk and merged in chunk order
+    // comes out the same however the work was shared.
+    template <typename Function>
+    void parallelFor(size_t count, size_t grainSize, Function &&run) {
+        size_t numChunks = getNumChunks(count, grainSize);
+        if (numThreads == 1 || numChunks <= 1) {
+            for (size_t chunk = 0; chunk < numChunks; chunk++) {
+                run(chunk, chunk * grainSize, std::min(count, (chunk + 1) * grainSize));
+            }
+            return;
+        }
+        std::function<void(size_t, size_t, size_t)> task = std::ref(run);
+        numRemaining.store(numChunks, std::memory_order_relaxed);
+        // Each thread starts with a contiguous run of chunks.
+        for (int worker = 0; worker < numThreads; worker++) {
+            size_t first = numChunks * worker / numThreads;
+            size_t last = numChunks * (worker + 1) / numThreads;
+            std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+            for (size_t chunk = first; chunk < last; chunk++) {
+                queues[worker]->chunks.push_back({&task, chunk, chunk * grainSize, std::min(count, (chunk + 1) * grainSize)});
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            generation++;
+        }
+        wake.notify_all();
+        while (numRemaining.load(std::memory_order_acquire) > 0) {
+            if (!runOneChunk(0)) std::this_thread::yield();
+        }
+    }
+
+private:
+    struct Chunk {
+        const std::function<void(size_t, size_t, size_t)> *task;
+        size_t index;
+        size_t begin;
+        size_t end;
+    };
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Chunk> chunks;
+    };
+    int numThreads;
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+    std::atomic<size_t> numRemaining = 0;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    uint64_t generation = 0;
+    bool isStopping = false;
+
+    bool popChunk(int worker, Chunk &chunk) {
+        {
+            WorkerQueue &own = *queues[worker];
+            std::lock_guard<std::mutex> lock(own.mutex);
+            if (!own.chunks.empty()) {
+                chunk = own.chunks.front();
+                own.chunks.pop_front();
+                return true;
+            }
+        }
+        for (int offset = 1; offset < numThreads; offset++) {
+            WorkerQueue &victim = *queues[(worker + offset) % numThreads];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.chunks.empty()) {
+                chunk = victim.chunks.back();
+                victim.chunks.pop_back();
+                numSteals.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        return false;
+    }
+    bool runOneChunk(int worker) {
+        Chunk chunk;
+        if (!popChunk(worker, chunk)) return false;
+        (*chunk.task)(chunk.index, chunk.begin, chunk.end);
+        numRemaining.fetch_sub(1, std::memory_order_acq_rel);
+        return true;
+    }
+    void runWorker(int worker) {
+        uint64_t seenGeneration = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(wakeMutex);
+                wake.wait(lock, [&] { return isStopping || generation != seenGeneration; });
+                if (isStopping) return;
+                seenGeneration = generation;
+            }
+            while (runOneChunk(worker)) {}
+        }
+    }
+};
+}
+
+namespace Profiling {
+// Milliseconds spent in each of a fixed list of sections, per frame, with the last
+// HISTORY_SIZE frames kept for graphs. A section entered several times in one frame
+// (the simulation can tick more than once per frame) reports the total.
+class FrameProfiler {
 public:
-    float duration;
-    float elapsed = 0;
-    bool isRunning = false;
-    std::function<void()> callback;
+    static constexpr int HISTORY_SIZE = 240;
+    // Scopes skip reading the clock while this is off.
+    bool isEnabled = true;
+    std::vector<const char *> sectionNames;
+    std::vector<std::array<float, HISTORY_SIZE>> history;
+    long numFrames = 0;
 
-    Timer(float duration, std::function<void()> callback) {
-        this->duration = duration;
-        this->callback = callback;
+    FrameProfiler(std::vector<const char *> sectionNames) {
+        this->sectionNames = sectionNames;
+        this->history.assign(sectionNames.size(), {});
+        this->current.assign(sectionNames.size(), 0);
     }
 
-    void start() {
+    int getNumSections() const {
+        return (int)sectionNames.size();
+    }
+    void add(int section, double milliseconds) {
+        current[section] += milliseconds;
+    }
+    void endFrame() {
+        for (int section = 0; section < getNumSections(); section++) {
+            history[section][numFrames % HISTORY_SIZE] = (float)current[section];
+            current[section] = 0;
+        }
+        numFrames++;
+    }
+    // framesAgo = 0 is the last finished frame.
+    float get(int section, int framesAgo) const {
+        if (framesAgo >= std::min<long>(numFrames, HISTORY_SIZE)) return 0;
+        return history[section][(numFrames - 1 - framesAgo) % HISTORY_SIZE];
+    }
+    float getAverage(int section, int numRecentFrames) const {
+        int count = (int)std::min<long>({numFrames, HISTORY_SIZE, numRecentFrames});
+        float total = 0;
+        for (int i = 0; i < count; i++) total += get(section, i);
+        return count > 0 ? total / count : 0;
+    }
+    float getMax(int section, int numRecentFrames) const {
+        int count = (int)std::min<long>({numFrames, HISTORY_SIZE, numRecentFrames});
+        float max = 0;
+        for (int i = 0; i < count; i++) max = std::max(max, get(section, i));
+        return max;
+    }
+
+private:
+    std::vector<double> current;
+};
+
+// Times from construction to destruction into one section.
+class Scope {
+public:
+    Scope(FrameProfiler &profiler, int section) : profiler(profiler) {
+        this->section = section;
+        if (profiler.isEnabled) this->start = std::chrono::steady_clock::now();
+    }
+    ~Scope() {
+        if (!profiler.isEnabled) return;
+        profiler.add(section, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    FrameProfiler &profiler;
+    int section;
+    std::chrono::steady_clock::time_point start;
+};
+}
+
+namespace Tracing {
+// One Chrome trace event. The name is not escaped or copied, so it has to be a string
+// literal (or otherwise outlive the writer) with no quotes or backslashes in it.
+struct Event {
+    const char *name;
+    char phase; // 'X' is a span from start for duration, 'i' is an instant with a value.
+    int64_t startNanoseconds;
+    int64_t durationNanoseconds;
+    int64_t value;
+};
+
+// Streams events to a Chrome trace JSON file (which Perfetto and chrome://tracing open).
+// Events go through a lock-free ring to a background thread that does the formatting and
+// file writes, so emitting one costs a clock read and a copy. Only one thread may emit;
+// events emitted while the ring is full are dropped and counted.
+class TraceWriter {
+public:
+    // Read by emitters on the emitting thread only, so a plain bool is enough.
+    bool isRecording = false;
+    std::atomic<long> numDropped{0};
+
+    TraceWriter() = default;
+    TraceWriter(const TraceWriter &) = delete;
+    TraceWriter &operator=(const TraceWriter &) = delete;
+    ~TraceWriter() {
+        stop();
+    }
+
+    bool start(const char *fileName, int flushMilliseconds = 2) {
+        stop();
+        file = std::fopen(fileName, "w");
+        if (file == nullptr) return false;
+        std::setvbuf(file, nullptr, _IOFBF, 1 << 20);
+        std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+        std::fputs("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"main\"}}", file);
+        origin = std::chrono::steady_clock::now();
+        numDropped = 0;
         isRunning = true;
-        elapsed = 0;
+        isRecording = true;
+        thread = std::thread([this, flushMilliseconds]() { run(flushMilliseconds); });
+        return true;
+    }
+    // Drains what is left, closes the JSON and the file.
+    void stop() {
+        if (!thread.joinable()) return;
+        isRecording = false;
+        isRunning = false;
+        thread.join();
+        drain();
+        if (numDropped > 0) {
+            write({"droppedEvents", 'i', now(), 0, numDropped.load()});
+        }
+        std::fputs("\n]}\n", file);
+        std::fclose(file);
+        file = nullptr;
+    }
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+    }
+    void emit(const Event &event) {
+        if (!events.push(event)) numDropped.fetch_add(1, std::memory_order_relaxed);
     }
+    void instant(const char *name, int64_t value = 0) {
+        if (isRecording) emit({name, 'i', now(), 0, value});
+    }
+
+private:
+    Queues::SpscRing<Event, 1 << 16> events;
+    std::atomic<bool> isRunning{false};
+    std::chrono::steady_clock::time_point origin;
+    std::FILE *file = nullptr;
+    std::thread thread;
 
-    void update(float dt) {
-        if (!isRunning) return;
-        elapsed += dt;
-        if (elapsed >= duration) {
-            isRunning = false;
-            callback();
+    void run(int flushMilliseconds) {
+        while (isRunning) {
+            if (drain() == 0) std::this_thread::sleep_for(std::chrono::milliseconds(flushMilliseconds));
+        }
+    }
+    int drain() {
+        int count = 0;
+        Event event;
+        while (events.pop(event)) {
+            write(event);
+            count++;
+        }
+        return count;
+    }
+    // Times are written as microseconds with integer formatting, which is a lot cheaper than %f.
+    void write(const Event &event) {
+        long long start = event.startNanoseconds, duration = event.durationNanoseconds;
+        if (event.phase == 'X') {
+            std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld.%03lld,\"dur\":%lld.%03lld,\"pid\":1,\"tid\":1}",
+                         event.name, start / 1000, start % 1000, duration / 1000, duration % 1000);
+        } else {
+            std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%lld.%03lld,\"pid\":1,\"tid\":1,\"args\":{\"value\":%lld}}",
+                         event.name, start / 1000, start % 1000, (long long)event.value);
         }
     }
 };
+
+// Emits one span from construction to destruction.
+class Scope {
+public:
+    Scope(TraceWriter &writer, const char *name) : writer(writer) {
+        this->name = name;
+        if (writer.isRecording) this->start = writer.now();
+    }
+    ~Scope() {
+        if (!writer.isRecording) return;
+        writer.emit({name, 'X', start, writer.now() - start, 0});
+    }
+    Scope(const Scope &) = delete;
+    Scope &operator=(const Scope &) = delete;
+
+private:
+    TraceWriter &writer;
+    const char *name;
+    int64_t start = 0;
+};
+}
+
+namespace Timers {
+// Refers to one scheduled timer. The generation makes a handle to a timer that has
+// already fired or been cancelled harmless, even after its slot has been reused.
+struct TimerHandle {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+};
+
+// Hierarchical timing wheel over whole ticks: NUM_LEVELS wheels of NUM_SLOTS slots, each
+// level 64 times coarser than the one below. Scheduling and cancelling are O(1) list
+// operations; advance() only touches the slot due this tick, plus once every 64 ticks
+// a coarser slot whose timers move down a level. Instead of calling callbacks, expired
+// timers hand back their Payload, a plain value saying what to do.
+template <typename Payload>
+class TimerWheel {
+public:
+    static constexpr int SLOT_BITS = 6;
+    static constexpr int NUM_SLOTS = 1 << SLOT_BITS;
+    static constexpr int NUM_LEVELS = 4;
+    static constexpr uint64_t MAX_DELAY = (1ull << (SLOT_BITS * NUM_LEVELS)) - 1;
+
+    uint64_t now = 0;
+
+    TimerWheel() {
+        std::fill(std::begin(heads), std::end(heads), NONE);
+    }
+
+    // Fires on the tick `delay` ticks from now, and at least one tick from now.
+    TimerHandle schedule(uint64_t delay, const Payload &payload) {
+        uint32_t index;
+        if (freeIndices.empty()) {
+            index = (uint32_t)nodes.size();
+            nodes.emplace_back();
+        } else {
+            index = freeIndices.back();
+            freeIndices.pop_back();
+        }
+        Node &node = nodes[index];
+        node.deadline = now + std::max<uint64_t>(delay, 1);
+        node.payload = payload;
+        node.isActive = true;
+        link(index);
+        numActive++;
+        return {index, node.generation};
+    }
+    // Does nothing if the timer has already fired or been cancelled. Resets the handle.
+    void cancel(TimerHandle &handle) {
+        if (isActive(handle)) {
+            unlink(handle.index);
+            release(handle.index);
+        }
+        handle = TimerHandle();
+    }
+    bool isActive(TimerHandle handle) const {
+        return handle.index < nodes.size() && nodes[handle.index].isActive && nodes[handle.index].generation == handle.generation;
+    }
+    // Ticks left until the timer fires, 0 if it is not active.
+    uint64_t getRemaining(TimerHandle handle) const {
+        return isActive(handle) ? nodes[handle.index].deadline - now : 0;
+    }
+    size_t size() const {
+        return numActive;
+    }
+    // Moves to the next tick and appends the payloads of every timer due on it.
+    void advance(std::vector<Payload> &expired) {
+        now++;
+        // Coarsest first, so timers cascading down several levels at once land correctly.
+        for (int level = NUM_LEVELS - 1; level > 0; level--) {
+            if ((now & ((1ull << (SLOT_BITS * level)) - 1)) == 0) cascade(level);
+        }
+        int32_t index = heads[now & (NUM_SLOTS - 1)];
+        heads[now & (NUM_SLOTS - 1)] = NONE;
+        while (index != NONE) {
+            int32_t next = nodes[index].next;
+            expired.push_back(nodes[index].payload);
+            release(index);
+            index = next;
+        }
+    }
+    void clear() {
+        for (uint32_t i = 0; i < nodes.size(); i++) {
+            if (nodes[i].isActive) release(i);
+        }
+        std::fill(std::begin(heads), std::end(heads), NONE);
+    }
+    // Saves or restores every timer, so handles taken before a save still work after a restore.
+    template <typename Stream>
+    void snapshot(Stream &stream) {
+        stream.field(now);
+        stream.field(nodes);
+        stream.field(freeIndices);
+        stream.field(heads);
+        stream.field(numActive);
+    }
+
+private:
+    static constexpr int32_t NONE = -1;
+
+    struct Node {
+        uint64_t deadline = 0;
+        Payload payload;
+        uint32_t generation = 0;
+        int32_t previous = NONE;
+        int32_t next = NONE;
+        uint16_t bucket = 0;
+        bool isActive = false;
+    };
+    std::vector<Node> nodes;
+    std::vector<uint32_t> freeIndices;
+    int32_t heads[NUM_LEVELS * NUM_SLOTS];
+    size_t numActive = 0;
+
+    // The finest level whose span covers the delay. Timers beyond the top level's span
+    // park in its furthest slot and get placed again when it cascades.
+    void link(uint32_t index) {
+        Node &node = nodes[index];
+        uint64_t deadline = std::min(node.deadline, now + MAX_DELAY);
+        uint64_t delay = deadline - now;
+        int level = 0;
+        while (level < NUM_LEVELS - 1 && delay >= (1ull << (SLOT_BITS * (level + 1)))) level++;
+        int bucket = level * NUM_SLOTS + (int)((deadline >> (SLOT_BITS * level)) & (NUM_SLOTS - 1));
+        node.bucket = (uint16_t)bucket;
+        node.previous = NONE;
+        node.next = heads[bucket];
+        if (node.next != NONE) nodes[node.next].previous = index;
+        heads[bucket] = index;
+    }
+    void unlink(uint32_t index) {
+        Node &node = nodes[index];
+        if (node.previous != NONE) {
+            nodes[node.previous].next = node.next;
+        } else {
+            heads[node.bucket] = node.next;
+        }
+        if (node.next != NONE) nodes[node.next].previous = node.previous;
+    }
+    void release(uint32_t index) {
+        nodes[index].isActive = false;
+        nodes[index].generation++;
+        freeIndices.push_back(index);
+        numActive--;
+    }
+    void cascade(int level) {
+        int bucket = level * NUM_SLOTS + (int)((now >> (SLOT_BITS * level)) & (NUM_SLOTS - 1));
+        int32_t index = heads[bucket];
+        heads[bucket] = NONE;
+        while (index != NONE) {
+            int32_t next = nodes[index].next;
+            link(index);
+            index = next;
+        }
+    }
+};
+}
+
+namespace Entities {
+// Refers to one entity in a pool that keeps its entities packed, so their indices change
+// as others are removed. A handle to a removed entity finds nothing, even once its slot
+// has been given to a new one.
+struct Handle {
+    uint32_t slot = UINT32_MAX;
+    uint32_t generation = 0;
 };
 
+// Maps handles to the current index of their entity. The pool calls move() whenever it
+// moves an entity to another index and remove() when the entity is gone.
+class HandleMap {
+public:
+    Handle add(uint32_t index) {
+        uint32_t slot;
+        if (freeSlots.empty()) {
+            slot = (uint32_t)slots.size();
+            slots.emplace_back();
+        } else {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        slots[slot].index = (int32_t)index;
+        return {slot, slots[slot].generation};
+    }
+    // -1 if the entity has been removed.
+    int32_t find(Handle handle) const {
+        if (handle.slot >= slots.size() || slots[handle.slot].generation != handle.generation) return -1;
+        return slots[handle.slot].index;
+    }
+    void move(Handle handle, uint32_t index) {
+        slots[handle.slot].index = (int32_t)index;
+    }
+    void remove(Handle handle) {
+        Slot &slot = slots[handle.slot];
+        slot.index = -1;
+        slot.generation++;
+        freeSlots.push_back(handle.slot);
+    }
+    template <typename Stream>
+    void snapshot(Stream &stream) {
+        stream.field(slots);
+        stream.field(freeSlots);
+    }
+
+private:
+    struct Slot {
+        int32_t index = -1;
+        uint32_t generation = 0;
+    };
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+};
+}
+
 namespace RayGuiTools {
 inline void SetAllButtonBaseStyles(int value) {
     GuiSetStyle(BUTTON, BASE_COLOR_NORMAL, value);
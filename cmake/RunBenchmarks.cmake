@@ -0,0 +1,83 @@
+# cmake -D "BUILDS=<exe>;<exe>..." -D OUTPUT_DIR=<dir> -P RunBenchmarks.cmake
+#
+# Runs every --benchmark scenario on each build, keeps the JSON results in OUTPUT_DIR and
+# prints the mean and p99 tick time of each, with its speedup over the first build.
+set(scenarios foods enemies arrows buddies)
+file(MAKE_DIRECTORY ${OUTPUT_DIR})
+
+# math() only does integers, so milliseconds like "0.0421" or "4.2e-05" become nanoseconds.
+function(milliseconds_to_nanoseconds milliseconds outVariable)
+    set(exponent 0)
+    if(milliseconds MATCHES "^([0-9.]+)[eE]([-+]?[0-9]+)$")
+        set(milliseconds ${CMAKE_MATCH_1})
+        math(EXPR exponent "${CMAKE_MATCH_2}")
+    endif()
+    set(fraction "")
+    if(milliseconds MATCHES "^([0-9]*)\\.([0-9]*)$")
+        set(milliseconds ${CMAKE_MATCH_1})
+        set(fraction ${CMAKE_MATCH_2})
+    endif()
+    # Shift the decimal point right by 6 + exponent digits.
+    math(EXPR shift "6 + ${exponent}")
+    if(shift LESS 0)
+        set(${outVariable} 0 PARENT_SCOPE)
+        return()
+    endif()
+    string(LENGTH "${fraction}" fractionLength)
+    while(fractionLength LESS shift)
+        string(APPEND fraction "0")
+        math(EXPR fractionLength "${fractionLength} + 1")
+    endwhile()
+    string(SUBSTRING "${fraction}" 0 ${shift} fraction)
+    math(EXPR nanoseconds "0${milliseconds}${fraction}")
+    set(${outVariable} ${nanoseconds} PARENT_SCOPE)
+endfunction()
+
+function(format_microseconds nanoseconds outVariable)
+    math(EXPR whole "${nanoseconds} / 1000")
+    math(EXPR tenths "${nanoseconds} % 1000 / 100")
+    set(${outVariable} "${whole}.${tenths} us" PARENT_SCOPE)
+endfunction()
+
+foreach(build IN LISTS BUILDS)
+    get_filename_component(buildName ${build} NAME_WE)
+    foreach(scenario IN LISTS scenarios)
+        set(output ${OUTPUT_DIR}/${buildName}_${scenario}.json)
+        execute_process(COMMAND ${build} --benchmark ${scenario} --output ${output}
+            OUTPUT_QUIET RESULT_VARIABLE result)
+        if(NOT result EQUAL 0)
+            message(FATAL_ERROR "${buildName} --benchmark ${scenario} failed: ${result}")
+        endif()
+    endforeach()
+endforeach()
+
+list(GET BUILDS 0 baseline)
+get_filename_component(baselineName ${baseline} NAME_WE)
+foreach(scenario IN LISTS scenarios)
+    message("${scenario}: time per tick")
+    file(READ ${OUTPUT_DIR}/${baselineName}_${scenario}.json json)
+    string(JSON baselineMean GET ${json} tick_ms mean)
+    milliseconds_to_nanoseconds(${baselineMean} baselineNanoseconds)
+    foreach(build IN LISTS BUILDS)
+        get_filename_component(buildName ${build} NAME_WE)
+        file(READ ${OUTPUT_DIR}/${buildName}_${scenario}.json json)
+        string(JSON mean GET ${json} tick_ms mean)
+        string(JSON p99 GET ${json} tick_ms p99)
+        milliseconds_to_nanoseconds(${mean} nanoseconds)
+        milliseconds_to_nanoseconds(${p99} p99Nanoseconds)
+        format_microseconds(${nanoseconds} mean)
+        format_microseconds(${p99Nanoseconds} p99)
+        set(speedup "-")
+        if(nanoseconds GREATER 0)
+            math(EXPR hundredths "${baselineNanoseconds} * 100 / ${nanoseconds}")
+            math(EXPR whole "${hundredths} / 100")
+            math(EXPR fraction "${hundredths} % 100")
+            string(LENGTH "${fraction}" fractionLength)
+            if(fractionLength EQUAL 1)
+                set(fraction "0${fraction}")
+            endif()
+            set(speedup "${whole}.${fraction}x")
+        endif()
+        message("  ${buildName}: mean ${mean}  p99 ${p99}  speedup ${speedup}")
+    endforeach()
+endforeach()
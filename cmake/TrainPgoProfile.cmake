@@ -0,0 +1,22 @@
+# cmake -D TRAINING=<instrumented exe> -P TrainPgoProfile.cmake
+#
+# The runs the PGO profile is gathered from: both headless modes, a stress wave spread over
+# worker threads and every benchmark scenario, so the hot loops see realistic entity counts.
+set(runs
+    "--headless --mode collecting --ticks 200000"
+    "--headless --mode fighting --ticks 200000"
+    "--headless --mode fighting --ticks 20000 --enemies 400 --threads 4"
+    "--benchmark foods --ticks 1000"
+    "--benchmark enemies --ticks 1000"
+    "--benchmark arrows --ticks 1000"
+    "--benchmark buddies --ticks 1000"
+    "--benchmark enemies --ticks 1000 --threads 4")
+
+foreach(run IN LISTS runs)
+    separate_arguments(arguments UNIX_COMMAND "${run}")
+    message(STATUS "falling_feast ${run}")
+    execute_process(COMMAND ${TRAINING} ${arguments} OUTPUT_QUIET RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "Training run failed (${result}): falling_feast ${run}")
+    endif()
+endforeach()
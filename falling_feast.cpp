@@ -1,11 +1,19 @@
+#include <algorithm>
 #include <array>
+#include <cerrno>
 #include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
 #include <ctime>
 #include "ExtraHeader.h"
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <raylib.h>
 #include <raymath.h>
+#include <string>
+#include <thread>
 #include <vector>
 
 #define RAYGUI_IMPLEMENTATION
@@ -15,6 +23,14 @@ constexpr int WINDOW_WIDTH = 1000;
 constexpr int WINDOW_HEIGHT = 800;
 constexpr int DEFAULT_FPS = 60;
 constexpr int FPS = 60;
+// The simulation always advances in fixed ticks; rendering interpolates between the last two.
+constexpr int TICK_RATE = 120;
+constexpr float TICK_TIME = 1.0f / TICK_RATE;
+constexpr int MAX_TICKS_PER_FRAME = 8;
+// The rewind buffer keeps as many of the latest ticks as fit in this much memory, with
+// a whole snapshot every keyframe interval and deltas against it in between.
+constexpr size_t REWIND_BUDGET_BYTES = 64 << 20;
+constexpr int REWIND_KEYFRAME_INTERVAL = TICK_RATE;
 
 Texture2D texturePlayer;
 Texture2D texturePlayerStanding;
@@ -29,6 +45,44 @@ Texture2D textureBow;
 Texture2D textureEnemy;
 Texture2D textureCoin;
 Texture2D textureBroccoliBuddy;
+Texture2D textureAtlas;
+
+// Every sprite image. The small ones (up to TITLE_SCREEN, exclusive) are packed into
+// textureAtlas at startup; their globals keep the sprite's own size but share the atlas
+// id, so they have to be drawn through a RenderQueue.
+enum class TextureKey : uint8_t {
+    PLAYER,
+    PLAYER_STANDING,
+    GOOD_FOOD_SPRITE_SHEET,
+    BAD_FOOD_SPRITE_SHEET,
+    PAUSE_PLAY_BUTTON_SPRITE_SHEET,
+    PROJECTILE_SPRITE_SHEET,
+    BOW,
+    ENEMY,
+    COIN,
+    BROCCOLI_BUDDY,
+    TITLE_SCREEN,
+    TERRAIN_SPRITE_SHEET,
+    GROUND_SPRITE_SHEET,
+};
+constexpr int NUM_ATLAS_SPRITES = static_cast<int>(TextureKey::TITLE_SCREEN);
+constexpr int NUM_TEXTURE_KEYS = static_cast<int>(TextureKey::GROUND_SPRITE_SHEET) + 1;
+// The atlas is page 0 and every texture too big to pack gets a page of its own.
+constexpr int NUM_TEXTURE_PAGES = 1 + NUM_TEXTURE_KEYS - NUM_ATLAS_SPRITES;
+constexpr int ATLAS_WIDTH = 1024;
+constexpr int ATLAS_PADDING = 2;
+
+Texture2D *const textures[NUM_TEXTURE_KEYS] = {
+    &texturePlayer, &texturePlayerStanding, &textureGoodFoodSpriteSheet, &textureBadFoodSpriteSheet,
+    &texturePausePlayButtonSpriteSheet, &textureProjectileSpriteSheet, &textureBow, &textureEnemy,
+    &textureCoin, &textureBroccoliBuddy, &textureTitleScreen, &textureTerrainSpriteSheet, &textureGroundSpriteSheet,
+};
+const char *const textureFileNames[NUM_TEXTURE_KEYS] = {
+    "images/player.png", "images/player_standing.png", "images/good_food_sprite_sheet.png", "images/bad_food_sprite_sheet.png",
+    "images/pause_play_button_sprite_sheet.png", "images/projectile_sprite_sheet.png", "images/bow.png", "images/enemy.png",
+    "images/coin.png", "images/broccoli_buddy.png", "images/title_screen.png", "images/terrain_sprite_sheet.png", "images/ground_sprite_sheet.png",
+};
+Rectangle atlasRegions[NUM_ATLAS_SPRITES];
 
 Sound soundFail;
 Sound soundLevelUp;
@@ -38,44 +92,698 @@ Sound soundClick;
 Sound soundShoot;
 Sound soundHit;
 Sound soundCollect;
+constexpr int NUM_SOUNDS = 8;
+Sound *const sounds[NUM_SOUNDS] = {
+    &soundFail, &soundLevelUp, &soundKaching, &soundBite, &soundClick, &soundShoot, &soundHit, &soundCollect,
+};
+const char *const soundFileNames[NUM_SOUNDS] = {
+    "sounds/fail.wav", "sounds/level_up.wav", "sounds/kaching.wav", "sounds/bite.wav",
+    "sounds/click.wav", "sounds/shoot.wav", "sounds/hit.wav", "sounds/collect.wav",
+};
 Music musicCollectingBackground;
 Music musicFightingBackground;
+constexpr int NUM_MUSIC_STREAMS = 2;
+Music *const musicStreams[NUM_MUSIC_STREAMS] = {&musicCollectingBackground, &musicFightingBackground};
+const char *const musicFileNames[NUM_MUSIC_STREAMS] = {"sounds/collecting_background.wav", "sounds/fighting_background.wav"};
 
 Font font;
+Text::GlyphRunCache numberText;
+const char *const FONT_FILE_NAME = "fonts/font.ttf";
+constexpr int FONT_BASE_SIZE = 64;
+constexpr int FONT_GLYPH_COUNT = 95; // printable ASCII, what LoadFontEx loads by default
+
+// Built with --pack-assets and looked for next to the executable. While it is loaded
+// the textures, sounds, music and font are built straight from its mapped memory.
+const char *const ASSET_PACK_FILE_NAME = "assets.pack";
+const char *const ATLAS_ENTRY_NAME = "atlas";
+AssetPack::Reader assetPack;
+bool isLoadedFromPack = false;
+
+// Assets are looked up next to the executable first, so the game does not depend on
+// being started from its own directory. Main thread only: GetApplicationDirectory()
+// refills one static buffer on every call.
+std::string getAssetPath(const char *fileName) {
+    std::string path = std::string(GetApplicationDirectory()) + fileName;
+    return FileExists(path.c_str()) ? path : fileName;
+}
+
+// Lays the atlas out from the sprite sizes alone, so headless runs get the same pages.
+// Returns the atlas height.
+int packAtlasRegions() {
+    std::vector<Vector2> sizes;
+    for (int i = 0; i < NUM_ATLAS_SPRITES; i++) {
+        sizes.push_back({(float)textures[i]->width, (float)textures[i]->height});
+    }
+    int atlasHeight = 0;
+    std::vector<Rectangle> regions = Textures::PackShelves(sizes, ATLAS_WIDTH, ATLAS_PADDING, atlasHeight);
+    std::copy(regions.begin(), regions.end(), atlasRegions);
+    return atlasHeight;
+}
+
+// Decodes the small sprites and blits them into one image laid out by packAtlasRegions().
+Image loadAtlasImage() {
+    Image atlasSprites[NUM_ATLAS_SPRITES];
+    for (int i = 0; i < NUM_ATLAS_SPRITES; i++) {
+        atlasSprites[i] = LoadImage(getAssetPath(textureFileNames[i]).c_str());
+        textures[i]->width = atlasSprites[i].width;
+        textures[i]->height = atlasSprites[i].height;
+    }
+    Image atlas = GenImageColor(ATLAS_WIDTH, packAtlasRegions(), BLANK);
+    for (int i = 0; i < NUM_ATLAS_SPRITES; i++) {
+        ImageDraw(&atlas, atlasSprites[i], {0, 0, (float)atlasSprites[i].width, (float)atlasSprites[i].height}, atlasRegions[i], WHITE);
+        UnloadImage(atlasSprites[i]);
+    }
+    return atlas;
+}
+
+void setAtlasTexture(Image atlas) {
+    textureAtlas = LoadTextureFromImage(atlas);
+    for (int i = 0; i < NUM_ATLAS_SPRITES; i++) {
+        textures[i]->id = textureAtlas.id;
+        textures[i]->mipmaps = textureAtlas.mipmaps;
+        textures[i]->format = textureAtlas.format;
+    }
+}
+
+// Decoded data waiting for its upload on the main thread.
+struct DecodedMedia {
+    Image images[NUM_TEXTURE_KEYS];
+    Wave waves[NUM_SOUNDS];
+    GlyphInfo *glyphs = nullptr;
+    Rectangle *glyphRecs = nullptr;
+    Image fontAtlas;
+    int numAtlasSpritesDecoded = 0;
+};
+
+// The title screen goes first so the loading screen can show it as soon as possible.
+// The paths are worked out here, on the main thread, and handed to the decode jobs.
+void addMediaJobs(Loading::ParallelLoader &loader, DecodedMedia &media) {
+    int titleScreenIndex = static_cast<int>(TextureKey::TITLE_SCREEN);
+    for (int i = titleScreenIndex; i < NUM_TEXTURE_KEYS; i++) {
+        loader.add(textureFileNames[i], [&media, i, path = getAssetPath(textureFileNames[i])]() {
+            media.images[i] = LoadImage(path.c_str());
+        }, [&media, i]() {
+            *textures[i] = LoadTextureFromImage(media.images[i]);
+            UnloadImage(media.images[i]);
+        });
+    }
+    for (int i = 0; i < NUM_ATLAS_SPRITES; i++) {
+        loader.add(textureFileNames[i], [&media, i, path = getAssetPath(textureFileNames[i])]() {
+            media.images[i] = LoadImage(path.c_str());
+        }, [&media, i]() {
+            textures[i]->width = media.images[i].width;
+            textures[i]->height = media.images[i].height;
+            if (++media.numAtlasSpritesDecoded < NUM_ATLAS_SPRITES) return;
+            Image atlas = GenImageColor(ATLAS_WIDTH, packAtlasRegions(), BLANK);
+            for (int j = 0; j < NUM_ATLAS_SPRITES; j++) {
+                ImageDraw(&atlas, media.images[j], {0, 0, (float)media.images[j].width, (float)media.images[j].height}, atlasRegions[j], WHITE);
+                UnloadImage(media.images[j]);
+            }
+            setAtlasTexture(atlas);
+            UnloadImage(atlas);
+        });
+    }
+    for (int i = 0; i < NUM_SOUNDS; i++) {
+        loader.add(soundFileNames[i], [&media, i, path = getAssetPath(soundFileNames[i])]() {
+            media.waves[i] = LoadWave(path.c_str());
+        }, [&media, i]() {
+            *sounds[i] = LoadSoundFromWave(media.waves[i]);
+            UnloadWave(media.waves[i]);
+        });
+    }
+    // Opening a stream needs the audio device, so there is nothing to do off the main thread.
+    for (int i = 0; i < NUM_MUSIC_STREAMS; i++) {
+        loader.add(musicFileNames[i], nullptr, [i]() {
+            *musicStreams[i] = LoadMusicStream(getAssetPath(musicFileNames[i]).c_str());
+        });
+    }
+    // The same steps as LoadFontEx, split at the texture upload.
+    loader.add(FONT_FILE_NAME, [&media, path = getAssetPath(FONT_FILE_NAME)]() {
+        int fontDataSize = 0;
+        unsigned char *fontData = LoadFileData(path.c_str(), &fontDataSize);
+        media.glyphs = LoadFontData(fontData, fontDataSize, FONT_BASE_SIZE, nullptr, FONT_GLYPH_COUNT, FONT_DEFAULT);
+        media.fontAtlas = GenImageFontAtlas(media.glyphs, &media.glyphRecs, FONT_GLYPH_COUNT, FONT_BASE_SIZE, FONT_TTF_DEFAULT_CHARS_PADDING, 0);
+        UnloadFileData(fontData);
+    }, [&media]() {
+        font.baseSize = FONT_BASE_SIZE;
+        font.glyphCount = FONT_GLYPH_COUNT;
+        font.glyphPadding = FONT_TTF_DEFAULT_CHARS_PADDING;
+        font.glyphs = media.glyphs;
+        font.recs = media.glyphRecs;
+        font.texture = LoadTextureFromImage(media.fontAtlas);
+        UnloadImage(media.fontAtlas);
+    });
+}
+
+void drawLoadingScreen(float progress) {
+    BeginDrawing();
+    ClearBackground(BLACK);
+    if (IsTextureValid(textureTitleScreen)) DrawTexture(textureTitleScreen, 0, 0, WHITE);
+    Rectangle bar = {WINDOW_WIDTH / 2.0f - 200.0f, WINDOW_HEIGHT - 80.0f, 400.0f, 20.0f};
+    DrawRectangleRec(bar, Fade(BLACK, 0.5f));
+    DrawRectangleRec({bar.x, bar.y, bar.width * progress, bar.height}, WHITE);
+    DrawRectangleLinesEx(bar, 2.0f, BLACK);
+    EndDrawing();
+}
+
+// Decodes on every core while the main thread opens the audio device, uploads what is
+// ready and keeps a progress bar on screen.
+void loadMediaFromFiles() {
+    auto startTime = std::chrono::steady_clock::now();
+    DecodedMedia media;
+    Loading::ParallelLoader loader;
+    addMediaJobs(loader, media);
+    loader.start(std::max(1u, std::thread::hardware_concurrency()));
+    InitAudioDevice();
+    while (!loader.uploadDecoded()) {
+        drawLoadingScreen(loader.getProgress());
+    }
+
+    double totalDecodeMilliseconds = 0;
+    for (const auto &job: loader.jobs) {
+        TraceLog(LOG_INFO, "Loaded %s: decode %.2f ms, upload %.2f ms", job->name.c_str(), job->decodeMilliseconds, job->uploadMilliseconds);
+        totalDecodeMilliseconds += job->decodeMilliseconds;
+    }
+    std::chrono::duration<double, std::milli> loadTime = std::chrono::steady_clock::now() - startTime;
+    TraceLog(LOG_INFO, "Loaded %i assets in %.1f ms (%.1f ms of decoding)", (int)loader.jobs.size(), loadTime.count(), totalDecodeMilliseconds);
+}
+
+// Nothing is decoded here: pixels, samples and the font atlas are uploaded as they sit in
+// the mapping. Returns false, having loaded nothing, if the pack is missing an entry.
+bool loadMediaFromPack(const AssetPack::Reader &pack) {
+    const AssetPack::Entry *atlasEntry = pack.find(ATLAS_ENTRY_NAME, AssetPack::EntryType::IMAGE);
+    const AssetPack::Entry *textureEntries[NUM_TEXTURE_KEYS];
+    const AssetPack::Entry *soundEntries[NUM_SOUNDS];
+    const AssetPack::Entry *musicEntries[NUM_MUSIC_STREAMS];
+    const AssetPack::Entry *fontEntry = pack.find(FONT_FILE_NAME, AssetPack::EntryType::FONT);
+    bool isComplete = atlasEntry != nullptr && fontEntry != nullptr;
+    for (int i = 0; i < NUM_TEXTURE_KEYS; i++) {
+        textureEntries[i] = pack.find(textureFileNames[i], AssetPack::EntryType::IMAGE);
+        isComplete = isComplete && textureEntries[i] != nullptr;
+    }
+    for (int i = 0; i < NUM_SOUNDS; i++) {
+        soundEntries[i] = pack.find(soundFileNames[i], AssetPack::EntryType::WAVE);
+        isComplete = isComplete && soundEntries[i] != nullptr;
+    }
+    for (int i = 0; i < NUM_MUSIC_STREAMS; i++) {
+        musicEntries[i] = pack.find(musicFileNames[i], AssetPack::EntryType::FILE);
+        isComplete = isComplete && musicEntries[i] != nullptr;
+    }
+    if (!isComplete) return false;
+
+    for (int i = 0; i < NUM_ATLAS_SPRITES; i++) {
+        textures[i]->width = textureEntries[i]->params[0];
+        textures[i]->height = textureEntries[i]->params[1];
+    }
+    // The regions are recomputed rather than stored, so they must come out the same as
+    // when the pack was built.
+    if (packAtlasRegions() != atlasEntry->params[1]) return false;
+    setAtlasTexture(pack.getImage(*atlasEntry));
+    for (int i = NUM_ATLAS_SPRITES; i < NUM_TEXTURE_KEYS; i++) {
+        *textures[i] = LoadTextureFromImage(pack.getImage(*textureEntries[i]));
+    }
+    for (int i = 0; i < NUM_SOUNDS; i++) {
+        *sounds[i] = LoadSoundFromWave(pack.getWave(*soundEntries[i]));
+    }
+    // Music stays encoded and is streamed out of the mapping as it plays.
+    for (int i = 0; i < NUM_MUSIC_STREAMS; i++) {
+        *musicStreams[i] = LoadMusicStreamFromMemory(".wav", pack.getData(*musicEntries[i]), (int)musicEntries[i]->size);
+    }
+    font = pack.loadFont(*fontEntry);
+    return true;
+}
 
 void loadMedia() {
-    texturePlayer = LoadTexture("images/player.png");
-    texturePlayerStanding = LoadTexture("images/player_standing.png");
-    textureTerrainSpriteSheet = LoadTexture("images/terrain_sprite_sheet.png");
-    textureGroundSpriteSheet = LoadTexture("images/ground_sprite_sheet.png");
-    textureGoodFoodSpriteSheet = LoadTexture("images/good_food_sprite_sheet.png");
-    textureBadFoodSpriteSheet = LoadTexture("images/bad_food_sprite_sheet.png");
-    texturePausePlayButtonSpriteSheet = LoadTexture("images/pause_play_button_sprite_sheet.png");
-    textureProjectileSpriteSheet = LoadTexture("images/projectile_sprite_sheet.png");
-    textureBow = LoadTexture("images/bow.png");
-    textureTitleScreen = LoadTexture("images/title_screen.png");
-    textureEnemy = LoadTexture("images/enemy.png");
-    textureCoin = LoadTexture("images/coin.png");
-    textureBroccoliBuddy = LoadTexture("images/broccoli_buddy.png");
-
-    soundFail = LoadSound("sounds/fail.wav");
-    soundLevelUp = LoadSound("sounds/level_up.wav");
-    soundKaching = LoadSound("sounds/kaching.wav");
-    soundBite = LoadSound("sounds/bite.wav");
-    soundClick = LoadSound("sounds/click.wav");
-    soundShoot = LoadSound("sounds/shoot.wav");
-    soundHit = LoadSound("sounds/hit.wav");
-    soundCollect = LoadSound("sounds/collect.wav");
-
-    musicCollectingBackground = LoadMusicStream("sounds/collecting_background.wav");
-    musicFightingBackground = LoadMusicStream("sounds/fighting_background.wav");
-
-    font = LoadFontEx("fonts/font.ttf", 64, nullptr, 0);
+    std::string packPath = std::string(GetApplicationDirectory()) + ASSET_PACK_FILE_NAME;
+    if (assetPack.open(packPath.c_str())) {
+        InitAudioDevice();
+        isLoadedFromPack = loadMediaFromPack(assetPack);
+        if (isLoadedFromPack) return;
+        CloseAudioDevice();
+    }
+    loadMediaFromFiles();
+}
+
+// The simulation only reads texture dimensions, so headless runs fill those in
+// without decoding any images or touching the GPU.
+void loadMediaHeadless() {
+    texturePlayer.width = 115; texturePlayer.height = 297;
+    texturePlayerStanding.width = 83; texturePlayerStanding.height = 268;
+    textureTerrainSpriteSheet.width = 5000; textureTerrainSpriteSheet.height = 800;
+    textureGroundSpriteSheet.width = 5000; textureGroundSpriteSheet.height = 800;
+    textureGoodFoodSpriteSheet.width = 480; textureGoodFoodSpriteSheet.height = 80;
+    textureBadFoodSpriteSheet.width = 480; textureBadFoodSpriteSheet.height = 80;
+    texturePausePlayButtonSpriteSheet.width = 100; texturePausePlayButtonSpriteSheet.height = 50;
+    textureProjectileSpriteSheet.width = 200; textureProjectileSpriteSheet.height = 13;
+    textureBow.width = 29; textureBow.height = 150;
+    textureTitleScreen.width = 1000; textureTitleScreen.height = 800;
+    textureEnemy.width = 127; textureEnemy.height = 268;
+    textureCoin.width = 50; textureCoin.height = 50;
+    textureBroccoliBuddy.width = 100; textureBroccoliBuddy.height = 192;
+    packAtlasRegions();
+}
+
+enum class RenderLayer : uint8_t {
+    BACKGROUND,
+    FOOD,
+    CHARACTERS,
+    WEAPONS,
+    PROJECTILES,
+    PICKUPS,
+    HUD,
+};
+constexpr int NUM_RENDER_LAYERS = static_cast<int>(RenderLayer::HUD) + 1;
+
+struct SpriteCommand {
+    uint8_t sortKey;
+    TextureKey texture;
+    Rectangle source;
+    Rectangle dest;
+    Vector2 origin;
+    float rotation;
+    Color tint;
+};
+
+inline int getTexturePage(TextureKey texture) {
+    int key = static_cast<int>(texture);
+    return key < NUM_ATLAS_SPRITES ? 0 : 1 + key - NUM_ATLAS_SPRITES;
+}
+
+// Sprites are queued here while drawing, ordered by layer and then texture page with a
+// counting sort, and issued so that each page is bound as few times as possible.
+// Sources are given in the sprite's own pixels and moved into the atlas at flush time.
+// Without a window it still sorts and counts, which is what the batching stats come from.
+class RenderQueue {
+public:
+    std::vector<SpriteCommand> commands;
+    int numDrawCalls = 0;
+    int numBatches = 0;
+    int numUnsortedBatches = 0;
+
+    RenderQueue(size_t capacity) {
+        commands.reserve(capacity);
+        sortedCommands.reserve(capacity);
+    }
+
+    void submit(RenderLayer layer, TextureKey texture, Rectangle source, Rectangle dest, Vector2 origin = {0, 0}, float rotation = 0, Color tint = WHITE) {
+        uint8_t sortKey = static_cast<uint8_t>(static_cast<int>(layer) * NUM_TEXTURE_PAGES + getTexturePage(texture));
+        commands.push_back({sortKey, texture, source, dest, origin, rotation, tint});
+    }
+    void flush(bool shouldDraw) {
+        numDrawCalls = (int)commands.size();
+        numUnsortedBatches = countBatches(commands);
+
+        int bucketStart[NUM_RENDER_LAYERS * NUM_TEXTURE_PAGES + 1] = {0};
+        for (const SpriteCommand &command: commands) bucketStart[command.sortKey + 1]++;
+        for (int i = 1; i <= NUM_RENDER_LAYERS * NUM_TEXTURE_PAGES; i++) bucketStart[i] += bucketStart[i - 1];
+        sortedCommands.resize(commands.size());
+        for (const SpriteCommand &command: commands) sortedCommands[bucketStart[command.sortKey]++] = command;
+        numBatches = countBatches(sortedCommands);
+
+        if (shouldDraw) {
+            for (const SpriteCommand &command: sortedCommands) {
+                Rectangle source = command.source;
+                int key = static_cast<int>(command.texture);
+                if (key < NUM_ATLAS_SPRITES) {
+                    source.x += atlasRegions[key].x;
+                    source.y += atlasRegions[key].y;
+                }
+                DrawTexturePro(*textures[key], source, command.dest, command.origin, command.rotation, command.tint);
+            }
+        }
+        commands.clear();
+    }
+
+private:
+    std::vector<SpriteCommand> sortedCommands;
+
+    static int countBatches(const std::vector<SpriteCommand> &commands) {
+        int numBatches = 0;
+        int page = -1;
+        for (const SpriteCommand &command: commands) {
+            int commandPage = getTexturePage(command.texture);
+            if (commandPage != page) numBatches++;
+            page = commandPage;
+        }
+        return numBatches;
+    }
+};
+
+// Everything the simulation needs from the keyboard, mouse and GUI for one update.
+// The windowed build fills it from raylib, headless runs fill it from a script.
+struct InputState {
+    Vector2 mousePosition = {0};
+    bool isMovingLeft = false;
+    bool isMovingRight = false;
+    bool isMovingUp = false;
+    bool isMovingDown = false;
+    bool isShootPressed = false;
+    bool isMouseLeftPressed = false;
+    bool isDebugTogglePressed = false;
+    bool isChangeBackgroundPressed = false;
+    bool isTitleScreenPressed = false;
+
+    // raygui buttons live in Game::draw(), so their clicks are carried over to the next update.
+    int selectedGameStateIndex = -1;
+    bool isTitleScreenClicked = false;
+    bool isChangeBackgroundClicked = false;
+    bool isPurchaseClicked = false;
+    bool isLevelUpClicked = false;
+    bool isBuyBroccoliBuddyClicked = false;
+    bool isNewGameClicked = false;
+
+    // Keeps one-shot presses around until a simulation tick has consumed them,
+    // since a fast frame may run no tick at all.
+    void latch(const InputState &newer) {
+        mousePosition = newer.mousePosition;
+        isMovingLeft = newer.isMovingLeft;
+        isMovingRight = newer.isMovingRight;
+        isMovingUp = newer.isMovingUp;
+        isMovingDown = newer.isMovingDown;
+        isShootPressed |= newer.isShootPressed;
+        isMouseLeftPressed |= newer.isMouseLeftPressed;
+        isDebugTogglePressed |= newer.isDebugTogglePressed;
+        isChangeBackgroundPressed |= newer.isChangeBackgroundPressed;
+        isTitleScreenPressed |= newer.isTitleScreenPressed;
+        if (newer.selectedGameStateIndex >= 0) selectedGameStateIndex = newer.selectedGameStateIndex;
+        isTitleScreenClicked |= newer.isTitleScreenClicked;
+        isChangeBackgroundClicked |= newer.isChangeBackgroundClicked;
+        isPurchaseClicked |= newer.isPurchaseClicked;
+        isLevelUpClicked |= newer.isLevelUpClicked;
+        isBuyBroccoliBuddyClicked |= newer.isBuyBroccoliBuddyClicked;
+        isNewGameClicked |= newer.isNewGameClicked;
+    }
+    void clearPresses() {
+        isShootPressed = false;
+        isMouseLeftPressed = false;
+        isDebugTogglePressed = false;
+        isChangeBackgroundPressed = false;
+        isTitleScreenPressed = false;
+        selectedGameStateIndex = -1;
+        isTitleScreenClicked = false;
+        isChangeBackgroundClicked = false;
+        isPurchaseClicked = false;
+        isLevelUpClicked = false;
+        isBuyBroccoliBuddyClicked = false;
+        isNewGameClicked = false;
+    }
+};
+
+// Accumulates real frame time and hands it out as whole simulation ticks.
+class FixedTimestep {
+public:
+    double accumulator = 0;
+    int numDroppedTicks = 0;
+
+    int advance(float frameTime) {
+        accumulator += frameTime;
+        int numTicks = static_cast<int>(accumulator / TICK_TIME);
+        if (numTicks > MAX_TICKS_PER_FRAME) {
+            // Too far behind to catch up without stalling the next frame too, so let the time go.
+            numDroppedTicks += numTicks - MAX_TICKS_PER_FRAME;
+            numTicks = MAX_TICKS_PER_FRAME;
+            accumulator = 0;
+        } else {
+            accumulator -= numTicks * TICK_TIME;
+        }
+        return numTicks;
+    }
+    float alpha() const {
+        return Clamp(static_cast<float>(accumulator / TICK_TIME), 0.0f, 1.0f);
+    }
+};
+
+InputState pollInput() {
+    InputState input;
+    input.mousePosition = GetMousePosition();
+    input.isMovingLeft = IsKeyDown(KEY_A);
+    input.isMovingRight = IsKeyDown(KEY_D);
+    input.isMovingUp = IsKeyDown(KEY_W);
+    input.isMovingDown = IsKeyDown(KEY_S);
+    input.isShootPressed = IsKeyPressed(KEY_SPACE);
+    input.isMouseLeftPressed = IsMouseButtonPressed(MOUSE_BUTTON_LEFT);
+    input.isDebugTogglePressed = IsKeyPressed(KEY_TAB);
+    input.isChangeBackgroundPressed = IsKeyPressed(KEY_G);
+    input.isTitleScreenPressed = IsKeyPressed(KEY_T);
+    return input;
+}
+
+// Binary log of a session: the RNG seed, then for every tick the input it ran with and a
+// hash of the state it produced. Held keys and presses are bit flags; the mouse position
+// and the game mode selection are only written on the ticks they change.
+namespace InputLog {
+constexpr uint32_t MAGIC = 0x52494646; // "FFIR"
+constexpr uint32_t VERSION = 7;
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t seed;
+    uint32_t tickRate;
+    uint32_t waveSize;
+};
+
+enum Flags : uint32_t {
+    MOVING_LEFT = 1 << 0,
+    MOVING_RIGHT = 1 << 1,
+    MOVING_UP = 1 << 2,
+    MOVING_DOWN = 1 << 3,
+    SHOOT_PRESSED = 1 << 4,
+    MOUSE_LEFT_PRESSED = 1 << 5,
+    DEBUG_TOGGLE_PRESSED = 1 << 6,
+    CHANGE_BACKGROUND_PRESSED = 1 << 7,
+    TITLE_SCREEN_PRESSED = 1 << 8,
+    TITLE_SCREEN_CLICKED = 1 << 9,
+    CHANGE_BACKGROUND_CLICKED = 1 << 10,
+    PURCHASE_CLICKED = 1 << 11,
+    LEVEL_UP_CLICKED = 1 << 12,
+    BUY_BROCCOLI_BUDDY_CLICKED = 1 << 13,
+    NEW_GAME_CLICKED = 1 << 14,
+    GAME_STATE_SELECTED = 1 << 15,
+    MOUSE_MOVED = 1 << 16,
+};
+
+// Every flag but the last two, in bit order.
+inline std::array<bool InputState::*, 15> flagFields() {
+    return {&InputState::isMovingLeft, &InputState::isMovingRight, &InputState::isMovingUp, &InputState::isMovingDown,
+            &InputState::isShootPressed, &InputState::isMouseLeftPressed, &InputState::isDebugTogglePressed,
+            &InputState::isChangeBackgroundPressed, &InputState::isTitleScreenPressed, &InputState::isTitleScreenClicked,
+            &InputState::isChangeBackgroundClicked, &InputState::isPurchaseClicked, &InputState::isLevelUpClicked,
+            &InputState::isBuyBroccoliBuddyClicked, &InputState::isNewGameClicked};
+}
+
+class Recorder {
+public:
+    long numTicks = 0;
+
+    bool open(const char *fileName, uint32_t seed, uint32_t waveSize) {
+        file.open(fileName, std::ios::binary);
+        Header header = {MAGIC, VERSION, seed, TICK_RATE, waveSize};
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        return file.good();
+    }
+    bool isOpen() const {
+        return file.is_open();
+    }
+    void write(const InputState &input, uint64_t stateHash) {
+        uint32_t flags = 0;
+        auto fields = flagFields();
+        for (size_t i = 0; i < fields.size(); i++) {
+            if (input.*fields[i]) flags |= 1 << i;
+        }
+        if (input.selectedGameStateIndex >= 0) flags |= GAME_STATE_SELECTED;
+        bool hasMouseMoved = numTicks == 0 || input.mousePosition.x != mousePosition.x || input.mousePosition.y != mousePosition.y;
+        if (hasMouseMoved) flags |= MOUSE_MOVED;
+
+        file.write(reinterpret_cast<const char *>(&flags), sizeof(flags));
+        if (flags & GAME_STATE_SELECTED) {
+            int8_t index = static_cast<int8_t>(input.selectedGameStateIndex);
+            file.write(reinterpret_cast<const char *>(&index), sizeof(index));
+        }
+        if (flags & MOUSE_MOVED) {
+            file.write(reinterpret_cast<const char *>(&input.mousePosition), sizeof(input.mousePosition));
+            mousePosition = input.mousePosition;
+        }
+        file.write(reinterpret_cast<const char *>(&stateHash), sizeof(stateHash));
+        numTicks++;
+    }
+
+private:
+    std::ofstream file;
+    Vector2 mousePosition = {0};
+};
+
+class Replay {
+public:
+    Header header;
+
+    bool open(const char *fileName) {
+        std::ifstream file(fileName, std::ios::binary);
+        data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        if (!read(header)) return false;
+        return header.magic == MAGIC && header.version == VERSION && header.tickRate == (uint32_t)TICK_RATE;
+    }
+    // Fills in the next tick's input and expected state hash. Returns false at the end.
+    bool next(InputState &input, uint64_t &stateHash) {
+        uint32_t flags;
+        if (!read(flags)) return false;
+        input = InputState();
+        auto fields = flagFields();
+        for (size_t i = 0; i < fields.size(); i++) {
+            input.*fields[i] = flags & (1 << i);
+        }
+        if (flags & GAME_STATE_SELECTED) {
+            int8_t index;
+            if (!read(index)) return false;
+            input.selectedGameStateIndex = index;
+        }
+        if (flags & MOUSE_MOVED) {
+            if (!read(mousePosition)) return false;
+        }
+        input.mousePosition = mousePosition;
+        return read(stateHash);
+    }
+
+private:
+    std::vector<char> data;
+    size_t offset = 0;
+    Vector2 mousePosition = {0};
+
+    template <typename T>
+    bool read(T &item) {
+        if (offset + sizeof(T) > data.size()) return false;
+        std::memcpy(&item, data.data() + offset, sizeof(T));
+        offset += sizeof(T);
+        return true;
+    }
+};
+}
+
+// A saved game on disk: a header, then the bytes Game::snapshot() writes. The hash of the
+// payload is checked before any of it is restored, so a damaged file is turned away
+// instead of leaving the game half loaded.
+namespace SnapshotFile {
+constexpr uint32_t MAGIC = 0x4e534646; // "FFSN"
+constexpr uint32_t VERSION = 2;
+// The windowed game saves here, next to the executable, when it closes and resumes from it on launch.
+const char *const SAVED_GAME_FILE_NAME = "savegame.bin";
+
+struct Header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t tickRate;
+    uint32_t reserved;
+    uint64_t payloadSize;
+    uint64_t payloadHash;
+};
+
+uint64_t hashPayload(const std::vector<char> &payload) {
+    Hashing::Fnv1a hash;
+    if (!payload.empty()) hash.add(payload.data(), payload.size());
+    return hash.value;
+}
+bool write(const std::string &fileName, const std::vector<char> &payload) {
+    std::ofstream file(fileName, std::ios::binary);
+    Header header = {MAGIC, VERSION, (uint32_t)TICK_RATE, 0, payload.size(), hashPayload(payload)};
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(payload.data(), payload.size());
+    return file.good();
+}
+// Leaves the payload empty and returns false unless the file is a whole snapshot from this version.
+bool read(const std::string &fileName, std::vector<char> &payload) {
+    payload.clear();
+    std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+    std::streamoff fileSize = file.tellg();
+    file.seekg(0);
+    Header header;
+    if (!file.read(reinterpret_cast<char *>(&header), sizeof(header))) return false;
+    if (header.magic != MAGIC || header.version != VERSION || header.tickRate != (uint32_t)TICK_RATE) return false;
+    if (header.payloadSize != (uint64_t)(fileSize - (std::streamoff)sizeof(header))) return false;
+    payload.resize(header.payloadSize);
+    if (!file.read(payload.data(), payload.size()) || hashPayload(payload) != header.payloadHash) {
+        payload.clear();
+        return false;
+    }
+    return true;
+}
+}
+
+// Things that happened during an update that the presentation layer may react to.
+enum class GameEvent {
+    BUTTON_CLICKED,
+    FOOD_EATEN,
+    PROJECTILE_FIRED,
+    PROJECTILE_HIT,
+    COIN_COLLECTED,
+    PURCHASED,
+    LEVELED_UP,
+    PLAYER_DIED,
+};
+
+constexpr int NUM_GAME_EVENTS = static_cast<int>(GameEvent::PLAYER_DIED) + 1;
+constexpr int MAX_VOICES = 12;
+constexpr int VOICES_PER_SOUND = 3;
+
+// Indexed by GameEvent. Rare sounds that tell the player something win over the
+// constant shooting when voices run out.
+struct EventSound {
+    Sound *sound;
+    int priority;
+};
+const EventSound eventSounds[NUM_GAME_EVENTS] = {
+    {&soundClick, 3},
+    {&soundBite, 1},
+    {&soundShoot, 0},
+    {&soundHit, 1},
+    {&soundCollect, 2},
+    {&soundKaching, 3},
+    {&soundLevelUp, 3},
+    {&soundFail, 4},
+};
+Sounds::VoicePool voicePool(MAX_VOICES, VOICES_PER_SOUND);
+
+// Track numbers are indices into musicStreams.
+constexpr int MUSIC_TRACK_COLLECTING = 0;
+constexpr int MUSIC_TRACK_FIGHTING = 1;
+constexpr float MUSIC_CROSSFADE_TIME = 1.0f;
+Sounds::MusicThread musicThread;
+
+// Sound indices in the pool match the GameEvent values.
+void loadVoices() {
+    for (const EventSound &eventSound: eventSounds) {
+        voicePool.addSound(*eventSound.sound, eventSound.priority);
+    }
+}
+
+void playEventSound(GameEvent event) {
+    voicePool.trigger(static_cast<int>(event));
+}
+
+// What a timer means when it fires. ENEMY_SHOOT and BUDDY_* timers name their entity by
+// handle; one whose entity has since been removed is ignored.
+enum class TimerKind : uint8_t {
+    SPAWN_FOOD,
+    ATTRACTION_OVER,
+    SPEED_OVER,
+    IMMUNITY_OVER,
+    ENEMY_SHOOT,
+    BUDDY_SHOOT,
+    BUDDY_EXPIRED,
+};
+struct TimerPayload {
+    TimerKind kind;
+    Entities::Handle entity = {};
+};
+using GameTimers = Timers::TimerWheel<TimerPayload>;
+
+uint64_t secondsToTicks(float seconds) {
+    return static_cast<uint64_t>(std::max(0L, std::lround(seconds * TICK_RATE)));
 }
 
 class Player {
 public:
     Vector2 position;
+    Vector2 previousPosition;
     Vector2 size;
     Vector2 center;
     float velocity;
@@ -96,40 +804,41 @@ public:
     bool isImmune = false;
     
     float powerUpDuration = 25.0f;
-    float attractionTimer = 0;
-    float speedTimer = 0;
-    float immunityTimer = 0;
+    Timers::TimerHandle attractionTimer;
+    Timers::TimerHandle speedTimer;
+    Timers::TimerHandle immunityTimer;
 
     Player() {
         this->size = {(float)texturePlayer.width, (float)texturePlayer.height};
         this->position = {400.0f, groundY - size.y};
+        this->previousPosition = position;
         this->velocity = 8.0f * DEFAULT_FPS;
         this->nutrition = 100.0f;
         this->maxHealth = 100.0f;
         this->health = maxHealth;
     }
 
-    void draw(int gameModeIndex) {
-        if (gameModeIndex == 0) {
-            DrawTexture(texturePlayer, position.x, position.y, WHITE);
-        } else {
-            DrawTexture(texturePlayerStanding, position.x, position.y, WHITE);
-        }
+    void submit(RenderQueue &renderQueue, int gameModeIndex, float alpha) {
+        Vector2 drawPosition = Vector2Lerp(previousPosition, position, alpha);
+        TextureKey texture = gameModeIndex == 0 ? TextureKey::PLAYER : TextureKey::PLAYER_STANDING;
+        Vector2 textureSize = {(float)textures[static_cast<int>(texture)]->width, (float)textures[static_cast<int>(texture)]->height};
+        renderQueue.submit(RenderLayer::CHARACTERS, texture, {0, 0, textureSize.x, textureSize.y}, {drawPosition.x, drawPosition.y, textureSize.x, textureSize.y});
     }
-    void update(double dt, double timeElapsed, int gameStateIndex) {
+    void update(double dt, double timeElapsed, int gameStateIndex, const InputState &input) {
         if (gameStateIndex != prevGameStateIndex) {
             Vector2 toBeSavedPosition = position;
             position = savedPosition;
+            previousPosition = position;
             savedPosition = toBeSavedPosition;
         }
         if (isExtraFast) {
             velocity = 15.0f * DEFAULT_FPS;
         }
         if (gameStateIndex == 0) velocity = 8.0f * DEFAULT_FPS;
-        if (IsKeyDown(KEY_A) && position.x > 0) {
+        if (input.isMovingLeft && position.x > 0) {
             position.x -= velocity * dt;
         }
-        if (IsKeyDown(KEY_D) && position.x + size.x < WINDOW_WIDTH) {
+        if (input.isMovingRight && position.x + size.x < WINDOW_WIDTH) {
             position.x += velocity * dt;
         }
         if (gameStateIndex == 0) {
@@ -137,15 +846,15 @@ public:
             size = {(float)texturePlayer.width, (float)texturePlayer.height};
         }
         if (gameStateIndex == 1) {
-            if (IsKeyDown(KEY_W) && position.y > 0) {
+            if (input.isMovingUp && position.y > 0) {
                 position.y -= velocity * dt;
             }
-            if (IsKeyDown(KEY_S) && position.y + size.y < WINDOW_HEIGHT) {
+            if (input.isMovingDown && position.y + size.y < WINDOW_HEIGHT) {
                 position.y += velocity * dt;
             }
             size = {(float)texturePlayerStanding.width, (float)texturePlayerStanding.height};
         }
-        Vector2 mousePos = GetMousePosition();
+        Vector2 mousePos = input.mousePosition;
         Vector2 delta = Vector2Subtract({position.x + size.x / 2, position.y + size.y / 2}, {mousePos});
         lookingAngle = atan2(delta.y, delta.x) * RAD2DEG;
 
@@ -163,57 +872,222 @@ public:
         DrawRectangleLinesEx({position.x, position.y, size.x, size.y}, 2, RED);
         DrawCircleV(position, 3, BLUE);
     }
+    template <typename Stream>
+    void snapshot(Stream &stream) {
+        stream.field(position);
+        stream.field(previousPosition);
+        stream.field(size);
+        stream.field(center);
+        stream.field(velocity);
+        stream.field(nutrition);
+        stream.field(prevGameStateIndex);
+        stream.field(coins);
+        stream.field(savedPosition);
+        stream.field(lookingAngle);
+        stream.field(level);
+        stream.field(health);
+        stream.field(maxHealth);
+        stream.field(isDead);
+        stream.field(isAttracting);
+        stream.field(isExtraFast);
+        stream.field(isImmune);
+        stream.field(powerUpDuration);
+        stream.field(attractionTimer);
+        stream.field(speedTimer);
+        stream.field(immunityTimer);
+    }
 };
 
-class Projectile {
-public: 
-    Vector2 position;
-    Vector2 size;
-    Vector2 velocity;
-    Vector2 origin;
-    int spriteSheetIndex;
-    float angleDeg;
-    std::array<Vector2, 4> rectCorners;
+// Which side fired a projectile. Targets only ask the broad phase for the layers that can hurt them.
+namespace CollisionLayers {
+constexpr uint32_t PLAYER_PROJECTILE = 1 << 0;
+constexpr uint32_t ENEMY_PROJECTILE = 1 << 1;
 
-    bool isPlayerProjectile;
-    bool shouldBeDestroyed = false;
+constexpr uint32_t HITS_PLAYER = ENEMY_PROJECTILE;
+constexpr uint32_t HITS_ENEMY = PLAYER_PROJECTILE;
+}
 
-    Projectile(Vector2 position, bool isPlayerProjectile, float angleDeg) {
-        this->position = position;
-        this->isPlayerProjectile = isPlayerProjectile;
-        Vector2 maximumVelocity = {10.0f * DEFAULT_FPS, 10.0f * DEFAULT_FPS};
-        velocity = {
-            (float)cos(angleDeg * DEG2RAD) * maximumVelocity.x,
-            (float)sin(angleDeg * DEG2RAD) * maximumVelocity.y,
-        };
-        this->spriteSheetIndex = static_cast<int>(!isPlayerProjectile);
-        this->angleDeg = angleDeg;
-        this->size = {100.0f, 13.0f};
-        this->origin = {size.x / 2.0f, size.y / 2.0f};
+constexpr size_t PROJECTILE_POOL_CAPACITY = 2048;
+constexpr Vector2 PROJECTILE_SIZE = {100.0f, 13.0f};
+constexpr Vector2 PROJECTILE_ORIGIN = {PROJECTILE_SIZE.x / 2.0f, PROJECTILE_SIZE.y / 2.0f};
+constexpr float PROJECTILE_SPEED = 10.0f * DEFAULT_FPS;
+
+// Fixed block of projectiles that never reallocates once the game is running.
+// Dead projectiles are swapped with the last live one, so removal is O(1) each.
+// Positions and velocities are kept one array per component for the SIMD integrator;
+// an arrow never turns, so its rotated corners and axis are worked out once when fired.
+class ProjectilePool {
+public:
+    std::vector<float> positionX;
+    std::vector<float> positionY;
+    std::vector<float> previousX;
+    std::vector<float> previousY;
+    std::vector<float> velocityX;
+    std::vector<float> velocityY;
+    std::vector<float> anglesDeg;
+    std::vector<Vector2> axes;
+    std::vector<std::array<Vector2, 4>> cornerOffsets;
+    std::vector<uint8_t> isPlayerProjectile;
+    std::vector<uint8_t> shouldBeDestroyed;
+    size_t poolCapacity;
+    size_t highWaterMark = 0;
+    long numDropped = 0;
+
+    ProjectilePool(size_t capacity) {
+        this->poolCapacity = capacity;
+        positionX.reserve(capacity);
+        positionY.reserve(capacity);
+        previousX.reserve(capacity);
+        previousY.reserve(capacity);
+        velocityX.reserve(capacity);
+        velocityY.reserve(capacity);
+        anglesDeg.reserve(capacity);
+        axes.reserve(capacity);
+        cornerOffsets.reserve(capacity);
+        isPlayerProjectile.reserve(capacity);
+        shouldBeDestroyed.reserve(capacity);
+    }
+
+    size_t capacity() const {
+        return poolCapacity;
+    }
+    size_t size() const {
+        return positionX.size();
+    }
+    Vector2 getPosition(size_t i) const {
+        return {positionX[i], positionY[i]};
+    }
+    Collision::OrientedBox getBox(size_t i) const {
+        return {getPosition(i), PROJECTILE_ORIGIN, axes[i]};
+    }
+    std::array<Vector2, 4> getCorners(size_t i) const {
+        std::array<Vector2, 4> corners = cornerOffsets[i];
+        for (Vector2 &corner: corners) corner = Vector2Add(corner, getPosition(i));
+        return corners;
+    }
+    // Returns false and drops the shot when every slot is already in flight.
+    bool spawn(Vector2 position, bool isPlayerProjectile, float angleDeg) {
+        if (size() == poolCapacity) {
+            numDropped++;
+            return false;
+        }
+        Vector2 axis = {cosf(angleDeg * DEG2RAD), sinf(angleDeg * DEG2RAD)};
+        positionX.push_back(position.x);
+        positionY.push_back(position.y);
+        previousX.push_back(position.x);
+        previousY.push_back(position.y);
+        velocityX.push_back(axis.x * PROJECTILE_SPEED);
+        velocityY.push_back(axis.y * PROJECTILE_SPEED);
+        anglesDeg.push_back(angleDeg);
+        axes.push_back(axis);
         std::array<Vector2, 4> localCorners = {
-            Vector2{ -origin.x, -origin.y },
-            Vector2{  origin.x, -origin.y },
-            Vector2{  origin.x,  origin.y },
-            Vector2{ -origin.x,  origin.y }
+            Vector2{ -PROJECTILE_ORIGIN.x, -PROJECTILE_ORIGIN.y },
+            Vector2{  PROJECTILE_ORIGIN.x, -PROJECTILE_ORIGIN.y },
+            Vector2{  PROJECTILE_ORIGIN.x,  PROJECTILE_ORIGIN.y },
+            Vector2{ -PROJECTILE_ORIGIN.x,  PROJECTILE_ORIGIN.y }
         };
-        for (int i = 0; i < 4; i++) {
-            Vector2 rotated = Vector2Rotate(localCorners[i], angleDeg * DEG2RAD);
-            rectCorners[i] = Vector2Add({position.x, position.y}, rotated);
+        for (Vector2 &corner: localCorners) {
+            corner = {corner.x * axis.x - corner.y * axis.y, corner.x * axis.y + corner.y * axis.x};
+        }
+        cornerOffsets.push_back(localCorners);
+        this->isPlayerProjectile.push_back(isPlayerProjectile);
+        shouldBeDestroyed.push_back(0);
+        highWaterMark = std::max(highWaterMark, size());
+        return true;
+    }
+    void savePreviousPositions() {
+        std::copy(positionX.begin(), positionX.end(), previousX.begin());
+        std::copy(positionY.begin(), positionY.end(), previousY.begin());
+    }
+    void update(float dt, size_t begin, size_t end) {
+        Kinematics::Integrate(positionX.data() + begin, velocityX.data() + begin, end - begin, dt);
+        Kinematics::Integrate(positionY.data() + begin, velocityY.data() + begin, end - begin, dt);
+    }
+    void removeDestroyed() {
+        for (size_t i = 0; i < size();) {
+            if (shouldBeDestroyed[i]) {
+                swapWithLast(i);
+                resize(size() - 1);
+            } else {
+                i++;
+            }
         }
     }
-
-    void draw() {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        
-        DrawTexturePro(textureProjectileSpriteSheet, src, dest, origin, angleDeg, WHITE);
-        // for (int i = 0; i < rectCorners.size(); i++) {
-        //     DrawLineEx(rectCorners.at(i), rectCorners.at(i != 3 ? i+1 : 0), 2, RED);
-        // }
-        // DrawCircleV(position, 5, BLUE);
+    void clear() {
+        resize(0);
+    }
+    void submit(RenderQueue &renderQueue, float alpha) {
+        for (size_t i = 0; i < size(); i++) {
+            Rectangle src = {(isPlayerProjectile[i] ? 0 : 1) * PROJECTILE_SIZE.x, 0, PROJECTILE_SIZE.x, PROJECTILE_SIZE.y};
+            Rectangle dest = {Lerp(previousX[i], positionX[i], alpha), Lerp(previousY[i], positionY[i], alpha), PROJECTILE_SIZE.x, PROJECTILE_SIZE.y};
+            renderQueue.submit(RenderLayer::PROJECTILES, TextureKey::PROJECTILE_SPRITE_SHEET, src, dest, PROJECTILE_ORIGIN, anglesDeg[i]);
+        }
+    }
+    void drawDebugLines() {
+        for (size_t i = 0; i < size(); i++) {
+            std::array<Vector2, 4> rectCorners = getCorners(i);
+            for (int j = 0; j < rectCorners.size(); j++) {
+                DrawLineEx(rectCorners.at(j), j == 3 ? rectCorners.at(0) : rectCorners.at(j + 1), 2, RED);
+            }
+            DrawCircleV(getPosition(i), 3, BLUE);
+        }
+    }
+    // Only the projectiles in flight; the capacity and the statistics belong to the running
+    // build. More projectiles than this build has room for are cut down to the capacity.
+    template <typename Stream>
+    void snapshot(Stream &stream) {
+        stream.field(positionX);
+        stream.field(positionY);
+        stream.field(previousX);
+        stream.field(previousY);
+        stream.field(velocityX);
+        stream.field(velocityY);
+        stream.field(anglesDeg);
+        stream.field(axes);
+        stream.field(cornerOffsets);
+        stream.field(isPlayerProjectile);
+        stream.field(shouldBeDestroyed);
+        if (size() > poolCapacity) resize(poolCapacity);
+        highWaterMark = std::max(highWaterMark, size());
+    }
+
+private:
+    void swapWithLast(size_t i) {
+        size_t last = size() - 1;
+        positionX[i] = positionX[last];
+        positionY[i] = positionY[last];
+        previousX[i] = previousX[last];
+        previousY[i] = previousY[last];
+        velocityX[i] = velocityX[last];
+        velocityY[i] = velocityY[last];
+        anglesDeg[i] = anglesDeg[last];
+        axes[i] = axes[last];
+        cornerOffsets[i] = cornerOffsets[last];
+        isPlayerProjectile[i] = isPlayerProjectile[last];
+        shouldBeDestroyed[i] = shouldBeDestroyed[last];
+    }
+    void resize(size_t count) {
+        positionX.resize(count);
+        positionY.resize(count);
+        previousX.resize(count);
+        previousY.resize(count);
+        velocityX.resize(count);
+        velocityY.resize(count);
+        anglesDeg.resize(count);
+        axes.resize(count);
+        cornerOffsets.resize(count);
+        isPlayerProjectile.resize(count);
+        shouldBeDestroyed.resize(count);
     }
-    void update(float dt) {
-        position = Vector2Add(position, {velocity.x * dt, velocity.y * dt});
+};
+
+// Where a character holds its bow, from the character's top-left corner.
+constexpr Vector2 BOW_HOLD_OFFSET = {50.0f, 125.0f};
+
+// Places a bow's hitbox around position. The rotated corner offsets are cached and only
+// re-rotated when the aim has actually changed since last time.
+void updateBowCorners(Vector2 position, Vector2 origin, float angleDeg, float &cornerOffsetsAngleDeg, std::array<Vector2, 4> &cornerOffsets, std::array<Vector2, 4> &rectCorners) {
+    if (angleDeg != cornerOffsetsAngleDeg) {
         std::array<Vector2, 4> localCorners = {
             Vector2{ -origin.x, -origin.y },
             Vector2{  origin.x, -origin.y },
@@ -221,402 +1095,478 @@ public:
             Vector2{ -origin.x,  origin.y }
         };
         for (int i = 0; i < 4; i++) {
-            Vector2 rotated = Vector2Rotate(localCorners[i], angleDeg * DEG2RAD);
-            rectCorners[i] = Vector2Add({position.x, position.y}, rotated);
+            cornerOffsets[i] = Vector2Rotate(localCorners[i], angleDeg * DEG2RAD);
         }
+        cornerOffsetsAngleDeg = angleDeg;
     }
-    void drawDebugLines() {
-        for (int i = 0; i < rectCorners.size(); i++) {
-            DrawLineEx(rectCorners.at(i), i == 3 ? rectCorners.at(0) : rectCorners.at(i + 1), 2, RED);
-        }
-        DrawCircleV(position, 3, BLUE);
+    for (int i = 0; i < 4; i++) {
+        rectCorners[i] = Vector2Add(position, cornerOffsets[i]);
     }
-};
+}
+void drawBowDebugLines(const std::array<Vector2, 4> &rectCorners, Vector2 position) {
+    for (int i = 0; i < rectCorners.size(); i++) {
+        DrawLineEx(rectCorners.at(i), i == 3 ? rectCorners.at(0) : rectCorners.at(i + 1), 2, RED);
+    }
+    DrawCircleV(position, 3, BLUE);
+}
 
+// The player's bow. Enemies and buddies keep theirs in their pool's BowArrays.
 class Bow {
 public: 
     Vector2 position;
+    Vector2 previousPosition;
     Vector2 size;
     Vector2 origin;
     Vector2 *followPosition;
-    Vector2 *pointingPosition;
-    float angleDeg;
+    float angleDeg = 0;
     float damage;
     float baseDamage;
     float extraDamagePerlevel;
     std::array<Vector2, 4> rectCorners;
+    std::array<Vector2, 4> cornerOffsets;
+    float cornerOffsetsAngleDeg = NAN;
     double *playerLevel;
 
-    bool isPlayerBow;
-    bool isBroccoliBow;
     bool shouldShoot = false;
     
-    Bow(Vector2 *followPosition, Vector2 *pointingPosition, bool isPlayerBow, bool isBroccoliBow, double *playerLevel) {
+    Bow(Vector2 *followPosition, double *playerLevel) {
         this->followPosition = followPosition;
-        this->position = {followPosition->x + 50.0f, followPosition->y + 125.0f};
+        this->position = Vector2Add(*followPosition, BOW_HOLD_OFFSET);
+        this->previousPosition = position;
         this->size = {(float)textureBow.width, (float)textureBow.height};
         this->origin = {size.x / 2.0f, size.y / 2.0f};
-        this->isPlayerBow = isPlayerBow;
         this->baseDamage = 10.0f;
-        this->isBroccoliBow = isBroccoliBow;
-        if (isPlayerBow || isBroccoliBow) {
-            this->playerLevel = playerLevel;
-            this->extraDamagePerlevel = 2.0f;
-        } else {
-            this->pointingPosition = pointingPosition;
-        }
+        this->damage = baseDamage;
+        this->playerLevel = playerLevel;
+        this->extraDamagePerlevel = 2.0f;
     }
 
-    void draw() {
+    void submit(RenderQueue &renderQueue, float alpha) {
+        Vector2 drawPosition = Vector2Lerp(previousPosition, position, alpha);
         Rectangle src = {0, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureBow, src, dest, origin, angleDeg, WHITE);
-        // for (int i = 0; i < rectCorners.size(); i++) {
-        //     DrawLineEx(rectCorners.at(i), rectCorners.at(i != 3 ? i+1 : 0), 2, RED);
-        // }
-        // DrawCircleV(position, 5, BLUE);
-    }
-    void update() {
-        position = {followPosition->x + 50.0f, followPosition->y + 125.0f};
-        if (isPlayerBow) {
-            Vector2 mousePos = GetMousePosition();
-            Vector2 delta = {
-                mousePos.x - position.x, 
-                mousePos.y - position.y
-            };
-            angleDeg = atan2(delta.y, delta.x) * RAD2DEG;
-
-            if (IsKeyPressed(KEY_SPACE)) {
-                shouldShoot = true;
-            }
-            damage = baseDamage + ((static_cast<int>(*playerLevel) - 1) * extraDamagePerlevel);
-        } else if (!isPlayerBow && !isBroccoliBow) {
-            Vector2 delta = {
-                pointingPosition->x - position.x, 
-                pointingPosition->y - position.y
-            };
-            angleDeg = atan2(delta.y, delta.x) * RAD2DEG;
-        }
-
-        std::array<Vector2, 4> localCorners = {
-            Vector2{ -origin.x, -origin.y },
-            Vector2{  origin.x, -origin.y },
-            Vector2{  origin.x,  origin.y },
-            Vector2{ -origin.x,  origin.y }
+        Rectangle dest = {drawPosition.x, drawPosition.y, size.x, size.y};
+        renderQueue.submit(RenderLayer::WEAPONS, TextureKey::BOW, src, dest, origin, angleDeg);
+    }
+    void update(const InputState &input) {
+        position = Vector2Add(*followPosition, BOW_HOLD_OFFSET);
+        Vector2 mousePos = input.mousePosition;
+        Vector2 delta = {
+            mousePos.x - position.x, 
+            mousePos.y - position.y
         };
-        for (int i = 0; i < 4; i++) {
-            Vector2 rotated = Vector2Rotate(localCorners[i], angleDeg * DEG2RAD);
-            rectCorners[i] = Vector2Add({position.x, position.y}, rotated);
+        angleDeg = atan2(delta.y, delta.x) * RAD2DEG;
+
+        if (input.isShootPressed) {
+            shouldShoot = true;
         }
+        damage = baseDamage + ((static_cast<int>(*playerLevel) - 1) * extraDamagePerlevel);
+        updateBowCorners(position, origin, angleDeg, cornerOffsetsAngleDeg, cornerOffsets, rectCorners);
     }
     void drawDebugLines() {
-        for (int i = 0; i < rectCorners.size(); i++) {
-            DrawLineEx(rectCorners.at(i), i == 3 ? rectCorners.at(0) : rectCorners.at(i + 1), 2, RED);
-        }
-        DrawCircleV(position, 3, BLUE);
+        drawBowDebugLines(rectCorners, position);
+    }
+    // The pointers and the sizes from the texture stay as the constructor set them.
+    template <typename Stream>
+    void snapshot(Stream &stream) {
+        stream.field(position);
+        stream.field(previousPosition);
+        stream.field(angleDeg);
+        stream.field(damage);
+        stream.field(rectCorners);
+        stream.field(cornerOffsets);
+        stream.field(cornerOffsetsAngleDeg);
+        stream.field(shouldShoot);
     }
 };
 
-class Enemy {
-public: 
-    Vector2 position;
-    Vector2 size;
-    Vector2 *playerPosition;
-    Vector2 velocity;
-    float playerAngleDeg;
-    float distanceToMove;
-    float distanceMoved = 0;
-    float shootingCooldown;
-    float lastShootingTime = 0;
-    float health;
-    std::unique_ptr<Bow> associatedBow;
-
-    bool hasReachedPosition = false;
-    bool shouldShoot = false;
-    bool isDead = false;
-
-    Enemy(Vector2 position, Vector2 *playerPosition) {
-        this->position = position;
-        this->playerPosition = playerPosition;
-        this->distanceToMove = 400.0f;
-        this->shootingCooldown = GetRandomValue(20, 25) / 10.0f;
-        this->health = 50.0f;
-        this->size = {(float)textureEnemy.width, (float)textureEnemy.height};
-        this->velocity = {8.0f * DEFAULT_FPS, 8.0f * DEFAULT_FPS};
-    }
+// The bows carried by one pool's characters, one array per field like the pool itself.
+// The bow at index i belongs to the character at index i, and moves with it.
+class BowArrays {
+public:
+    std::vector<float> positionX;
+    std::vector<float> positionY;
+    std::vector<float> previousX;
+    std::vector<float> previousY;
+    std::vector<float> anglesDeg;
+    std::vector<float> cornerOffsetsAnglesDeg;
+    std::vector<std::array<Vector2, 4>> cornerOffsets;
+    std::vector<std::array<Vector2, 4>> rectCorners;
+    std::vector<uint8_t> shouldShoot;
+    Vector2 bowSize;
+    Vector2 origin;
 
-    void draw() {
-        DrawTexture(textureEnemy, position.x, position.y, WHITE);
-        DrawTextEx(font, TextFormat("%i", (int)health), {position.x + 40.0f, position.y - 40.0f}, 35.0f, 1.0f, BLACK);
+    BowArrays() {
+        this->bowSize = {(float)textureBow.width, (float)textureBow.height};
+        this->origin = {bowSize.x / 2.0f, bowSize.y / 2.0f};
+    }
+
+    size_t size() const {
+        return positionX.size();
+    }
+    Vector2 getPosition(size_t i) const {
+        return {positionX[i], positionY[i]};
+    }
+    void add(Vector2 holderPosition) {
+        Vector2 position = Vector2Add(holderPosition, BOW_HOLD_OFFSET);
+        positionX.push_back(position.x);
+        positionY.push_back(position.y);
+        previousX.push_back(position.x);
+        previousY.push_back(position.y);
+        anglesDeg.push_back(0);
+        cornerOffsetsAnglesDeg.push_back(NAN);
+        cornerOffsets.emplace_back();
+        rectCorners.emplace_back();
+        shouldShoot.push_back(0);
+    }
+    void savePreviousPositions() {
+        std::copy(positionX.begin(), positionX.end(), previousX.begin());
+        std::copy(positionY.begin(), positionY.end(), previousY.begin());
+    }
+    // Puts bows [begin, end) back in their holders' hands.
+    void follow(const std::vector<float> &holderX, const std::vector<float> &holderY, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            positionX[i] = holderX[i] + BOW_HOLD_OFFSET.x;
+            positionY[i] = holderY[i] + BOW_HOLD_OFFSET.y;
+        }
     }
-    void update(float dt, float timeElapsed) {
-        Vector2 delta = Vector2Subtract(*playerPosition, position);
-        playerAngleDeg = atan2(delta.y, delta.x) * RAD2DEG;
-
-        if (hasReachedPosition) {
-            if (timeElapsed - lastShootingTime >= shootingCooldown) {
-                shouldShoot = true;
-                lastShootingTime = timeElapsed;
-            }
-        } else {
-            Vector2 velocityToMove = {
-                cos(playerAngleDeg * DEG2RAD) * velocity.x * dt,
-                sin(playerAngleDeg * DEG2RAD) * velocity.y * dt,
-            };
-            position = Vector2Add(position, velocityToMove);
-            distanceMoved += Vector2Length(velocityToMove);
-
-            if (distanceMoved >= distanceToMove) {
-                hasReachedPosition = true;
-            }
+    void aimAt(Vector2 target, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            anglesDeg[i] = atan2(target.y - positionY[i], target.x - positionX[i]) * RAD2DEG;
         }
-        if (health <= 0) {
-            health = 0;
-            isDead = true;
+    }
+    void updateCorners(size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            updateBowCorners(getPosition(i), origin, anglesDeg[i], cornerOffsetsAnglesDeg[i], cornerOffsets[i], rectCorners[i]);
         }
     }
-    void makeAssociatedBow(std::unique_ptr<Bow> associatedBow) {
-        this->associatedBow = std::move(associatedBow);
+    void submit(RenderQueue &renderQueue, float alpha) {
+        for (size_t i = 0; i < size(); i++) {
+            Rectangle dest = {Lerp(previousX[i], positionX[i], alpha), Lerp(previousY[i], positionY[i], alpha), bowSize.x, bowSize.y};
+            renderQueue.submit(RenderLayer::WEAPONS, TextureKey::BOW, {0, 0, bowSize.x, bowSize.y}, dest, origin, anglesDeg[i]);
+        }
     }
     void drawDebugLines() {
-        DrawRectangleLinesEx({position.x, position.y, size.x, size.y}, 2, RED);
-        DrawCircleV(position, 3, BLUE);
-    }
-};
-
-class Coin {
-public: 
-    Vector2 position;
-    Vector2 size;
-
-    bool shouldBeDestroyed = false;
-
-    Coin(Vector2 position) {
-        this->position = position;
-        this->size = {(float) textureCoin.width, (float) textureCoin.height};
-    }
-
-    void draw() {
-        DrawTexture(textureCoin, position.x, position.y, WHITE);
+        for (size_t i = 0; i < size(); i++) {
+            drawBowDebugLines(rectCorners[i], getPosition(i));
+        }
     }
-    void drawDebugLines() {
-        DrawRectangleLinesEx({position.x, position.y, size.x, size.y}, 2, RED);
-        DrawCircleV(position, 3, BLUE);
+    void move(size_t from, size_t to) {
+        positionX[to] = positionX[from];
+        positionY[to] = positionY[from];
+        previousX[to] = previousX[from];
+        previousY[to] = previousY[from];
+        anglesDeg[to] = anglesDeg[from];
+        cornerOffsetsAnglesDeg[to] = cornerOffsetsAnglesDeg[from];
+        cornerOffsets[to] = cornerOffsets[from];
+        rectCorners[to] = rectCorners[from];
+        shouldShoot[to] = shouldShoot[from];
+    }
+    void resize(size_t count) {
+        positionX.resize(count);
+        positionY.resize(count);
+        previousX.resize(count);
+        previousY.resize(count);
+        anglesDeg.resize(count);
+        cornerOffsetsAnglesDeg.resize(count);
+        cornerOffsets.resize(count);
+        rectCorners.resize(count);
+        shouldShoot.resize(count);
+    }
+    template <typename Stream>
+    void snapshot(Stream &stream) {
+        stream.field(positionX);
+        stream.field(positionY);
+        stream.field(previousX);
+        stream.field(previousY);
+        stream.field(anglesDeg);
+        stream.field(cornerOffsetsAnglesDeg);
+        stream.field(cornerOffsets);
+        stream.field(rectCorners);
+        stream.field(shouldShoot);
     }
 };
 
-class BroccoliBuddy {
-public: 
-    Vector2 position;
-    Vector2 size;
-    float velocity;
-    std::unique_ptr<Bow> associatedBow;
-    std::vector<std::unique_ptr<Enemy>> *enemies;
-    float shootTimer = 0;
-    float shootCooldown;
-    float distanceMoved = 0;
-    float aimingAngle = 0;
-    float existenceTime = 20.0f;
-    float existenceTimer = 0;
-
-    bool shouldBeDestroyed = false;
-    bool hasReachedPosition = false;
-
-    BroccoliBuddy(Vector2 position, std::vector<std::unique_ptr<Enemy>> *enemies) {
-        this->position = position;
-        this->size = {(float)textureBroccoliBuddy.width, (float)textureBroccoliBuddy.height};
-        this->velocity = 8.0f * DEFAULT_FPS;
-        this->shootCooldown = GetRandomValue(2, 5) / 10.0f;
-        this->enemies = enemies;
-    }
-
-    void draw(double timeElapsed) {
-        DrawTexture(textureBroccoliBuddy, position.x, position.y, WHITE);
-        if (hasReachedPosition) DrawTextEx(font, TextFormat("%i", (int)(existenceTime - (timeElapsed - existenceTimer))), {position.x + 30.0f, position.y - 40.0f}, 35.0f, 1.0f, BLACK);
-    }
-
-    void update(double dt, double timeElapsed) {
-        if (hasReachedPosition) {
-            if (!enemies->empty()) {
-                Vector2 enemyPosition = enemies->at(0)->position;
-                Vector2 enemySize = enemies->at(0)->size;
-                Vector2 delta = {enemyPosition.x + enemySize.x / 2 - (position.x + size.x / 2), 
-                    enemyPosition.y + enemySize.y / 2 - (position.y + size.y / 2)
-                };
-                aimingAngle = atan2(delta.y, delta.x) * RAD2DEG;
-                associatedBow->angleDeg = aimingAngle;
-            }
-
-            if (timeElapsed - shootTimer >= shootCooldown) {
-                associatedBow->shouldShoot = true;
-                shootTimer = timeElapsed;
-            }
-
-            if (timeElapsed - existenceTimer >= existenceTime) {
-                shouldBeDestroyed = true;
+// Fighting-mode enemies, one array per field like the other pools, so each step of
+// update() is a flat loop over just the fields it needs. The dead are compacted out in
+// order, which keeps the oldest enemy first. Because indices shift, timers refer to an
+// enemy by its handle and look its index up when they fire.
+class EnemyPool {
+public:
+    std::vector<float> positionX;
+    std::vector<float> positionY;
+    std::vector<float> previousX;
+    std::vector<float> previousY;
+    std::vector<float> velocityX;
+    std::vector<float> velocityY;
+    std::vector<float> distancesMoved;
+    std::vector<float> shootingCooldowns;
+    std::vector<float> health;
+    std::vector<Timers::TimerHandle> shootTimers;
+    std::vector<Entities::Handle> handles;
+    std::vector<uint8_t> hasReachedPosition;
+    std::vector<uint8_t> isDead;
+    BowArrays bows;
+    Entities::HandleMap handleMap;
+    Vector2 enemySize;
+    static constexpr float distanceToMove = 400.0f;
+    static constexpr float speed = 8.0f * DEFAULT_FPS;
+
+    EnemyPool() {
+        this->enemySize = {(float)textureEnemy.width, (float)textureEnemy.height};
+    }
+
+    size_t size() const {
+        return positionX.size();
+    }
+    bool empty() const {
+        return positionX.empty();
+    }
+    Vector2 getPosition(size_t i) const {
+        return {positionX[i], positionY[i]};
+    }
+    Rectangle getRect(size_t i) const {
+        return {positionX[i], positionY[i], enemySize.x, enemySize.y};
+    }
+    Vector2 getCenter(size_t i) const {
+        return {positionX[i] + enemySize.x / 2, positionY[i] + enemySize.y / 2};
+    }
+    Vector2 getVelocity(size_t i) const {
+        return {velocityX[i], velocityY[i]};
+    }
+    Entities::Handle spawn(Vector2 position, float shootingCooldown) {
+        Entities::Handle handle = handleMap.add((uint32_t)size());
+        positionX.push_back(position.x);
+        positionY.push_back(position.y);
+        previousX.push_back(position.x);
+        previousY.push_back(position.y);
+        velocityX.push_back(0);
+        velocityY.push_back(0);
+        distancesMoved.push_back(0);
+        shootingCooldowns.push_back(shootingCooldown);
+        health.push_back(50.0f);
+        shootTimers.emplace_back();
+        handles.push_back(handle);
+        hasReachedPosition.push_back(0);
+        isDead.push_back(0);
+        bows.add(position);
+        return handle;
+    }
+    void savePreviousPositions() {
+        std::copy(positionX.begin(), positionX.end(), previousX.begin());
+        std::copy(positionY.begin(), positionY.end(), previousY.begin());
+        bows.savePreviousPositions();
+    }
+    // Enemies walk toward the player until they have covered distanceToMove, then stand
+    // and shoot at them. Only touches enemies [begin, end), so disjoint ranges can run on
+    // different threads; the ones that arrive are appended to arrivals instead of
+    // scheduling their first shot on the shared timer wheel.
+    void updateMovement(float dt, Vector2 playerPosition, size_t begin, size_t end, std::vector<uint32_t> &arrivals) {
+        for (size_t i = begin; i < end; i++) {
+            if (hasReachedPosition[i]) continue;
+            float angle = atan2(playerPosition.y - positionY[i], playerPosition.x - positionX[i]);
+            velocityX[i] = cosf(angle) * speed;
+            velocityY[i] = sinf(angle) * speed;
+            Vector2 velocityToMove = {velocityX[i] * dt, velocityY[i] * dt};
+            positionX[i] += velocityToMove.x;
+            positionY[i] += velocityToMove.y;
+            distancesMoved[i] += Vector2Length(velocityToMove);
+
+            if (distancesMoved[i] >= distanceToMove) {
+                hasReachedPosition[i] = 1;
+                velocityX[i] = 0;
+                velocityY[i] = 0;
+                arrivals.push_back((uint32_t)i);
             }
-        } else {
-            position.y += velocity * dt;
-            distanceMoved += velocity * dt;
-
-            if (distanceMoved >= 400.0f) {
-                hasReachedPosition = true;
-                existenceTimer = timeElapsed;
+        }
+        for (size_t i = begin; i < end; i++) {
+            if (health[i] <= 0) {
+                health[i] = 0;
+                isDead[i] = 1;
             }
         }
     }
-    void drawDebugLines() {
-        DrawRectangleLinesEx({position.x, position.y, size.x, size.y}, 2, RED);
-        DrawCircleV(position, 3, BLUE);
-    }
-    void makeAssociatedBow(std::unique_ptr<Bow> associatedBow) {
-        this->associatedBow = std::move(associatedBow);
-    }
-};
-
-class GoodFood {
-public: 
-    Vector2 position;
-    Vector2 size;
-    float velocityY = 6.0f * DEFAULT_FPS;
-    float nutritionalValue;
-    int spriteSheetIndex;
-
-    bool shouldBeDestroyed = false;
-    bool isLeftOfPlayer;
-
-    GoodFood() {};
-
-    virtual void draw() = 0;
-    void update(double dt, double timeElapsed) {
-        position.y += velocityY * dt;
-        if (position.y > WINDOW_HEIGHT) shouldBeDestroyed = true;
-    }
-    void drawDebugLines() {
-        DrawRectangleLinesEx({position.x, position.y, size.x, size.y}, 2, RED);
-        DrawCircleV(position, 3, BLUE);
-    }
-};
-
-class Cheese : public GoodFood{
-public: 
-    Cheese(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->nutritionalValue = 30.0f;
-        this->spriteSheetIndex = 0;
-        this->velocityY = speed * DEFAULT_FPS;
-    }
-
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureGoodFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
-    }
-};
-
-class Apple : public GoodFood{
-public: 
-    Apple(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->nutritionalValue = 40.0f;
-        this->spriteSheetIndex = 1;
-        this->velocityY = speed * DEFAULT_FPS;
-    }
-
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureGoodFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
+    void updateBows(Vector2 playerCenter, size_t begin, size_t end) {
+        bows.follow(positionX, positionY, begin, end);
+        bows.aimAt(playerCenter, begin, end);
+        bows.updateCorners(begin, end);
     }
-};
-
-class Banana : public GoodFood{
-public: 
-    Banana(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->nutritionalValue = 45.0f;
-        this->spriteSheetIndex = 2;
-        this->velocityY = speed * DEFAULT_FPS;
+    // The first shot comes one cooldown into the fight, or as soon as the enemy has arrived.
+    void scheduleFirstShots(const std::vector<uint32_t> &arrivals, float timeElapsed, GameTimers &timers) {
+        for (uint32_t i: arrivals) {
+            shootTimers[i] = timers.schedule(secondsToTicks(shootingCooldowns[i] - timeElapsed), {TimerKind::ENEMY_SHOOT, handles[i]});
+        }
     }
-
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureGoodFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
+    void removeDead(GameTimers &timers) {
+        size_t count = 0;
+        for (size_t i = 0; i < size(); i++) {
+            if (isDead[i]) {
+                timers.cancel(shootTimers[i]);
+                handleMap.remove(handles[i]);
+            } else {
+                if (i != count) move(i, count);
+                count++;
+            }
+        }
+        resize(count);
     }
-};
-
-class Pizza : public GoodFood{
-public: 
-    Pizza(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->nutritionalValue = 50.0f;
-        this->spriteSheetIndex = 3;
-        this->velocityY = speed * DEFAULT_FPS;
+    void clear(GameTimers &timers) {
+        for (size_t i = 0; i < size(); i++) {
+            timers.cancel(shootTimers[i]);
+            handleMap.remove(handles[i]);
+        }
+        resize(0);
     }
-
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureGoodFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
+    void submit(RenderQueue &renderQueue, float alpha) {
+        for (size_t i = 0; i < size(); i++) {
+            Rectangle dest = {Lerp(previousX[i], positionX[i], alpha), Lerp(previousY[i], positionY[i], alpha), enemySize.x, enemySize.y};
+            renderQueue.submit(RenderLayer::CHARACTERS, TextureKey::ENEMY, {0, 0, enemySize.x, enemySize.y}, dest);
+        }
+        bows.submit(renderQueue, alpha);
     }
-};
-
-class Yoghurt : public GoodFood{
-public: 
-    Yoghurt(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->nutritionalValue = 55.0f;
-        this->spriteSheetIndex = 4;
-        this->velocityY = speed * DEFAULT_FPS;
+    void drawLabels(float alpha) {
+        for (size_t i = 0; i < size(); i++) {
+            Vector2 drawPosition = {Lerp(previousX[i], positionX[i], alpha), Lerp(previousY[i], positionY[i], alpha)};
+            numberText.draw(font, "%i", (int)health[i], {drawPosition.x + 40.0f, drawPosition.y - 40.0f}, 35.0f, 1.0f, BLACK);
+        }
     }
-
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureGoodFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
+    void drawDebugLines() {
+        for (size_t i = 0; i < size(); i++) {
+            DrawRectangleLinesEx(getRect(i), 2, RED);
+            DrawCircleV(getPosition(i), 3, BLUE);
+        }
+        bows.drawDebugLines();
+    }
+    template <typename Stream>
+    void snapshot(Stream &stream) {
+        stream.field(positionX);
+        stream.field(positionY);
+        stream.field(previousX);
+        stream.field(previousY);
+        stream.field(velocityX);
+        stream.field(velocityY);
+        stream.field(distancesMoved);
+        stream.field(shootingCooldowns);
+        stream.field(health);
+        stream.field(shootTimers);
+        stream.field(handles);
+        stream.field(hasReachedPosition);
+        stream.field(isDead);
+        bows.snapshot(stream);
+        handleMap.snapshot(stream);
+    }
+
+private:
+    void move(size_t from, size_t to) {
+        positionX[to] = positionX[from];
+        positionY[to] = positionY[from];
+        previousX[to] = previousX[from];
+        previousY[to] = previousY[from];
+        velocityX[to] = velocityX[from];
+        velocityY[to] = velocityY[from];
+        distancesMoved[to] = distancesMoved[from];
+        shootingCooldowns[to] = shootingCooldowns[from];
+        health[to] = health[from];
+        shootTimers[to] = shootTimers[from];
+        handles[to] = handles[from];
+        hasReachedPosition[to] = hasReachedPosition[from];
+        isDead[to] = isDead[from];
+        bows.move(from, to);
+        handleMap.move(handles[to], (uint32_t)to);
+    }
+    void resize(size_t count) {
+        positionX.resize(count);
+        positionY.resize(count);
+        previousX.resize(count);
+        previousY.resize(count);
+        velocityX.resize(count);
+        velocityY.resize(count);
+        distancesMoved.resize(count);
+        shootingCooldowns.resize(count);
+        health.resize(count);
+        shootTimers.resize(count);
+        handles.resize(count);
+        hasReachedPosition.resize(count);
+        isDead.resize(count);
+        bows.resize(count);
     }
 };
 
-class Potion : public GoodFood{
-public: 
-    Potion(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->nutritionalValue = 100.0f;
-        this->spriteSheetIndex = 5;
-        this->velocityY = speed * DEFAULT_FPS;
-    }
-
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureGoodFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
+// Picks what each buddy shoots at. Enemy centres go into a grid rebuilt every tick, so a
+// query only looks at the enemies around the buddy asking. Every pick is counted as a
+// claim, and later buddies prefer enemies with fewer claims, which spreads their fire
+// across the wave instead of all of them shooting the same enemy.
+class TargetSelector {
+public:
+    static constexpr int NUM_CANDIDATES = 4;
+    static constexpr float FINISHING_RADIUS = 350.0f;
+    static constexpr uint32_t ENEMY_LAYER = 1;
+
+    Collision::UniformGrid grid = Collision::UniformGrid({-200.0f, -200.0f, WINDOW_WIDTH + 400.0f, WINDOW_HEIGHT + 400.0f}, 100.0f);
+    const EnemyPool *enemies = nullptr;
+    std::vector<float> centersX;
+    std::vector<float> centersY;
+    std::vector<int> claims;
+    std::vector<std::pair<float, int>> nearest;
+
+    // Grid items are enemy indices, so this has to run again after enemies move or die.
+    void build(const EnemyPool &enemies) {
+        this->enemies = &enemies;
+        grid.clear();
+        centersX.resize(enemies.size());
+        centersY.resize(enemies.size());
+        claims.assign(enemies.size(), 0);
+        for (size_t i = 0; i < enemies.size(); i++) {
+            Vector2 center = enemies.getCenter(i);
+            centersX[i] = center.x;
+            centersY[i] = center.y;
+            grid.insert({center.x, center.y, 0, 0}, ENEMY_LAYER);
+        }
+        grid.build();
+    }
+    // The k nearest enemies are left in nearest, nearest first.
+    void findNearest(Vector2 point, int k) {
+        Targeting::FindNearest(grid, centersX.data(), centersY.data(), point, k, ENEMY_LAYER, nearest);
+    }
+    // The enemy with the least health within radius of point, -1 if there is none.
+    int findLowestHealth(Vector2 point, float radius) {
+        int lowest = -1;
+        grid.query({point.x - radius, point.y - radius, 2.0f * radius, 2.0f * radius}, ENEMY_LAYER, [&](int i) {
+            float dx = centersX[i] - point.x, dy = centersY[i] - point.y;
+            if (dx * dx + dy * dy > radius * radius) return;
+            if (lowest < 0 || enemies->health[i] < enemies->health[lowest] || (enemies->health[i] == enemies->health[lowest] && i < lowest)) lowest = i;
+        });
+        return lowest;
+    }
+    // Takes a nearby enemy that one more hit will finish if nobody has claimed it yet,
+    // otherwise whichever of the nearest few has the fewest claims. -1 if there are no enemies.
+    int chooseTarget(Vector2 point, float damage) {
+        int target = findLowestHealth(point, FINISHING_RADIUS);
+        if (target < 0 || claims[target] > 0 || enemies->health[target] > damage) {
+            findNearest(point, NUM_CANDIDATES);
+            target = -1;
+            for (const std::pair<float, int> &candidate: nearest) {
+                if (target < 0 || claims[candidate.second] < claims[target]) target = candidate.second;
+            }
+        }
+        if (target >= 0) claims[target]++;
+        return target;
     }
 };
 
-class BadFood {
+class Coin {
 public: 
     Vector2 position;
     Vector2 size;
-    float velocityY = 6.0f * DEFAULT_FPS;
-    float harmValue;
-    int spriteSheetIndex;
 
     bool shouldBeDestroyed = false;
-    bool isLeftOfPlayer;
 
-    BadFood() {};
+    Coin(Vector2 position) {
+        this->position = position;
+        this->size = {(float) textureCoin.width, (float) textureCoin.height};
+    }
 
-    virtual void draw() = 0;
-    void update(double dt, double timeElapsed) {
-        position.y += velocityY * dt;
-        if (position.y > WINDOW_HEIGHT) shouldBeDestroyed = true;
+    void submit(RenderQueue &renderQueue) {
+        renderQueue.submit(RenderLayer::PICKUPS, TextureKey::COIN, {0, 0, size.x, size.y}, {position.x, position.y, size.x, size.y});
     }
     void drawDebugLines() {
         DrawRectangleLinesEx({position.x, position.y, size.x, size.y}, 2, RED);
@@ -624,118 +1574,431 @@ public:
     }
 };
 
-class SpoiltCheese : public BadFood{
-public: 
-    SpoiltCheese(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->harmValue = 30.0f;
-        this->spriteSheetIndex = 0;
-        this->velocityY = speed * DEFAULT_FPS;
+// Bought helpers that drop in from the top, then shoot at the enemies TargetSelector
+// picks until they expire. Stored the same way as EnemyPool.
+class BroccoliBuddyPool {
+public:
+    std::vector<float> positionX;
+    std::vector<float> positionY;
+    std::vector<float> previousX;
+    std::vector<float> previousY;
+    std::vector<float> distancesMoved;
+    std::vector<float> shootCooldowns;
+    std::vector<Timers::TimerHandle> shootTimers;
+    std::vector<Timers::TimerHandle> existenceTimers;
+    std::vector<Entities::Handle> handles;
+    std::vector<Entities::Handle> targets;
+    std::vector<uint8_t> hasReachedPosition;
+    std::vector<uint8_t> shouldBeDestroyed;
+    BowArrays bows;
+    Entities::HandleMap handleMap;
+    Vector2 buddySize;
+    static constexpr float distanceToMove = 400.0f;
+    static constexpr float speed = 8.0f * DEFAULT_FPS;
+    static constexpr float existenceTime = 20.0f;
+
+    BroccoliBuddyPool() {
+        this->buddySize = {(float)textureBroccoliBuddy.width, (float)textureBroccoliBuddy.height};
+    }
+
+    size_t size() const {
+        return positionX.size();
+    }
+    Vector2 getPosition(size_t i) const {
+        return {positionX[i], positionY[i]};
+    }
+    Entities::Handle spawn(Vector2 position, float shootCooldown) {
+        Entities::Handle handle = handleMap.add((uint32_t)size());
+        positionX.push_back(position.x);
+        positionY.push_back(position.y);
+        previousX.push_back(position.x);
+        previousY.push_back(position.y);
+        distancesMoved.push_back(0);
+        shootCooldowns.push_back(shootCooldown);
+        shootTimers.emplace_back();
+        existenceTimers.emplace_back();
+        handles.push_back(handle);
+        targets.emplace_back();
+        hasReachedPosition.push_back(0);
+        shouldBeDestroyed.push_back(0);
+        bows.add(position);
+        return handle;
+    }
+    void savePreviousPositions() {
+        std::copy(positionX.begin(), positionX.end(), previousX.begin());
+        std::copy(positionY.begin(), positionY.end(), previousY.begin());
+        bows.savePreviousPositions();
+    }
+    // A buddy keeps its target until it dies, and picks again right before each shot.
+    // In between, its bow leads the target, aiming where it will be when an arrow fired
+    // now gets there.
+    void update(float dt, const EnemyPool &enemies, TargetSelector &targetSelector, float damage, GameTimers &timers) {
+        for (size_t i = 0; i < size(); i++) {
+            if (hasReachedPosition[i]) continue;
+            positionY[i] += speed * dt;
+            distancesMoved[i] += speed * dt;
+
+            if (distancesMoved[i] >= distanceToMove) {
+                hasReachedPosition[i] = 1;
+                shootTimers[i] = timers.schedule(1, {TimerKind::BUDDY_SHOOT, handles[i]});
+                existenceTimers[i] = timers.schedule(secondsToTicks(existenceTime), {TimerKind::BUDDY_EXPIRED, handles[i]});
+            }
+        }
+        bows.follow(positionX, positionY, 0, size());
+        for (size_t i = 0; i < size(); i++) {
+            int32_t target = enemies.handleMap.find(targets[i]);
+            if (target >= 0 && !bows.shouldShoot[i]) targetSelector.claims[target]++;
+        }
+        for (size_t i = 0; i < size(); i++) {
+            if (!hasReachedPosition[i]) continue;
+            Vector2 bowPosition = bows.getPosition(i);
+            int target = enemies.handleMap.find(targets[i]);
+            if (target < 0 || bows.shouldShoot[i]) {
+                target = targetSelector.chooseTarget(bowPosition, damage);
+                targets[i] = target >= 0 ? enemies.handles[target] : Entities::Handle();
+            }
+            if (target < 0) continue;
+            Vector2 aim = Targeting::LeadAim(bowPosition, enemies.getCenter(target), enemies.getVelocity(target), PROJECTILE_SPEED);
+            bows.anglesDeg[i] = atan2(aim.y - bowPosition.y, aim.x - bowPosition.x) * RAD2DEG;
+        }
+        bows.updateCorners(0, size());
+    }
+    void removeDestroyed(GameTimers &timers) {
+        size_t count = 0;
+        for (size_t i = 0; i < size(); i++) {
+            if (shouldBeDestroyed[i]) {
+                timers.cancel(shootTimers[i]);
+                timers.cancel(existenceTimers[i]);
+                handleMap.remove(handles[i]);
+            } else {
+                if (i != count) move(i, count);
+                count++;
+            }
+        }
+        resize(count);
     }
-
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureBadFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
+    void clear(GameTimers &timers) {
+        for (size_t i = 0; i < size(); i++) {
+            timers.cancel(shootTimers[i]);
+            timers.cancel(existenceTimers[i]);
+            handleMap.remove(handles[i]);
+        }
+        resize(0);
     }
-};
-
-class SpoiltApple : public BadFood{
-public: 
-    SpoiltApple(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->harmValue = 40.0f;
-        this->spriteSheetIndex = 1;
-        this->velocityY = speed * DEFAULT_FPS;
+    void submit(RenderQueue &renderQueue, float alpha) {
+        for (size_t i = 0; i < size(); i++) {
+            Rectangle dest = {Lerp(previousX[i], positionX[i], alpha), Lerp(previousY[i], positionY[i], alpha), buddySize.x, buddySize.y};
+            renderQueue.submit(RenderLayer::CHARACTERS, TextureKey::BROCCOLI_BUDDY, {0, 0, buddySize.x, buddySize.y}, dest);
+        }
+        bows.submit(renderQueue, alpha);
     }
-
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureBadFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
+    void drawLabels(const GameTimers &timers, float alpha) {
+        for (size_t i = 0; i < size(); i++) {
+            if (!hasReachedPosition[i]) continue;
+            Vector2 drawPosition = {Lerp(previousX[i], positionX[i], alpha), Lerp(previousY[i], positionY[i], alpha)};
+            numberText.draw(font, "%i", (int)(timers.getRemaining(existenceTimers[i]) * TICK_TIME), {drawPosition.x + 30.0f, drawPosition.y - 40.0f}, 35.0f, 1.0f, BLACK);
+        }
+    }
+    void drawDebugLines() {
+        for (size_t i = 0; i < size(); i++) {
+            DrawRectangleLinesEx({positionX[i], positionY[i], buddySize.x, buddySize.y}, 2, RED);
+            DrawCircleV(getPosition(i), 3, BLUE);
+        }
+        bows.drawDebugLines();
+    }
+    template <typename Stream>
+    void snapshot(Stream &stream) {
+        stream.field(positionX);
+        stream.field(positionY);
+        stream.field(previousX);
+        stream.field(previousY);
+        stream.field(distancesMoved);
+        stream.field(shootCooldowns);
+        stream.field(shootTimers);
+        stream.field(existenceTimers);
+        stream.field(handles);
+        stream.field(targets);
+        stream.field(hasReachedPosition);
+        stream.field(shouldBeDestroyed);
+        bows.snapshot(stream);
+        handleMap.snapshot(stream);
+    }
+
+private:
+    void move(size_t from, size_t to) {
+        positionX[to] = positionX[from];
+        positionY[to] = positionY[from];
+        previousX[to] = previousX[from];
+        previousY[to] = previousY[from];
+        distancesMoved[to] = distancesMoved[from];
+        shootCooldowns[to] = shootCooldowns[from];
+        shootTimers[to] = shootTimers[from];
+        existenceTimers[to] = existenceTimers[from];
+        handles[to] = handles[from];
+        targets[to] = targets[from];
+        hasReachedPosition[to] = hasReachedPosition[from];
+        shouldBeDestroyed[to] = shouldBeDestroyed[from];
+        bows.move(from, to);
+        handleMap.move(handles[to], (uint32_t)to);
+    }
+    void resize(size_t count) {
+        positionX.resize(count);
+        positionY.resize(count);
+        previousX.resize(count);
+        previousY.resize(count);
+        distancesMoved.resize(count);
+        shootCooldowns.resize(count);
+        shootTimers.resize(count);
+        existenceTimers.resize(count);
+        handles.resize(count);
+        targets.resize(count);
+        hasReachedPosition.resize(count);
+        shouldBeDestroyed.resize(count);
+        bows.resize(count);
     }
 };
 
-class SpoiltBanana : public BadFood{
-public: 
-    SpoiltBanana(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->harmValue = 45.0f;
-        this->spriteSheetIndex = 2;
-        this->velocityY = speed * DEFAULT_FPS;
-    }
+enum class FoodKind : uint8_t {
+    CHEESE, APPLE, BANANA, PIZZA, YOGHURT, POTION,
+    SPOILT_CHEESE, SPOILT_APPLE, SPOILT_BANANA, SPOILT_PIZZA, SPOILT_YOGHURT, SPOILT_POTION,
+};
 
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureBadFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
-    }
+struct FoodKindInfo {
+    float nutritionalValue;
+    int spriteSheetIndex;
+    bool isSpoilt;
 };
 
-class SpoiltPizza : public BadFood{
-public: 
-    SpoiltPizza(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->harmValue = 50.0f;
-        this->spriteSheetIndex = 3;
-        this->velocityY = speed * DEFAULT_FPS;
+// Indexed by FoodKind. Spoilt foods take their nutrition away instead of adding it.
+constexpr FoodKindInfo FOOD_KINDS[] = {
+    {30.0f, 0, false}, {40.0f, 1, false}, {45.0f, 2, false}, {50.0f, 3, false}, {55.0f, 4, false}, {100.0f, 5, false},
+    {-30.0f, 0, true}, {-40.0f, 1, true}, {-45.0f, 2, true}, {-50.0f, 3, true}, {-55.0f, 4, true}, {-100.0f, 5, true},
+};
+constexpr int NUM_FOOD_KINDS = sizeof(FOOD_KINDS) / sizeof(FOOD_KINDS[0]);
+constexpr int NUM_FRESH_FOOD_KINDS = NUM_FOOD_KINDS / 2;
+constexpr float FOOD_SIZE = 80.0f;
+constexpr size_t FOOD_POOL_CAPACITY = 16384;
+
+// Every falling food lives in these parallel arrays, so each pass over them is one
+// linear loop and spawning only appends to storage reserved up front.
+class FoodPool {
+public:
+    std::vector<float> positionX;
+    std::vector<float> positionY;
+    std::vector<float> previousX;
+    std::vector<float> previousY;
+    std::vector<float> velocityY;
+    std::vector<uint8_t> kinds;
+    std::vector<uint8_t> isLeftOfPlayer;
+    std::vector<uint8_t> shouldBeDestroyed;
+
+    FoodPool(size_t capacity) {
+        positionX.reserve(capacity);
+        positionY.reserve(capacity);
+        previousX.reserve(capacity);
+        previousY.reserve(capacity);
+        velocityY.reserve(capacity);
+        kinds.reserve(capacity);
+        isLeftOfPlayer.reserve(capacity);
+        shouldBeDestroyed.reserve(capacity);
+    }
+
+    size_t size() const {
+        return kinds.size();
+    }
+    void spawn(Vector2 position, float speed, FoodKind kind) {
+        positionX.push_back(position.x);
+        positionY.push_back(position.y);
+        previousX.push_back(position.x);
+        previousY.push_back(position.y);
+        velocityY.push_back(speed * DEFAULT_FPS);
+        kinds.push_back(static_cast<uint8_t>(kind));
+        isLeftOfPlayer.push_back(0);
+        shouldBeDestroyed.push_back(0);
+    }
+    void savePreviousPositions() {
+        std::copy(positionX.begin(), positionX.end(), previousX.begin());
+        std::copy(positionY.begin(), positionY.end(), previousY.begin());
+    }
+    // Pulls fresh food towards the player's basket and pushes spoilt food away from it.
+    void attract(float playerCenterX, float step) {
+        for (size_t i = 0; i < size(); i++) {
+            float direction = isLeftOfPlayer[i] ? 1.0f : -1.0f;
+            if (FOOD_KINDS[kinds[i]].isSpoilt) {
+                positionX[i] -= direction * step;
+                continue;
+            }
+            positionX[i] += direction * step;
+            float distance = positionX[i] + FOOD_SIZE / 2 - playerCenterX;
+            if (direction * distance > 0) positionX[i] -= direction * step;
+        }
     }
-
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureBadFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
+    void update(float dt, float playerCenterX, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            positionY[i] += velocityY[i] * dt;
+            isLeftOfPlayer[i] = positionX[i] + FOOD_SIZE / 2 <= playerCenterX;
+            shouldBeDestroyed[i] |= positionY[i] > WINDOW_HEIGHT;
+        }
     }
-};
-
-class SpoiltYoghurt : public BadFood{
-public: 
-    SpoiltYoghurt(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->harmValue = 55.0f;
-        this->spriteSheetIndex = 4;
-        this->velocityY = speed * DEFAULT_FPS;
+    // Marks every food overlapping the basket as eaten and returns the nutrition it was worth.
+    float consumeOverlapping(Rectangle basket, int &numEaten) {
+        float nutrition = 0;
+        for (size_t i = 0; i < size(); i++) {
+            bool isOverlapping = positionX[i] < basket.x + basket.width && positionX[i] + FOOD_SIZE > basket.x &&
+                                 positionY[i] < basket.y + basket.height && positionY[i] + FOOD_SIZE > basket.y;
+            if (isOverlapping && !shouldBeDestroyed[i]) {
+                nutrition += FOOD_KINDS[kinds[i]].nutritionalValue;
+                shouldBeDestroyed[i] = 1;
+                numEaten++;
+            }
+        }
+        return nutrition;
+    }
+    // Compacts the survivors to the front in one pass, keeping their draw order.
+    void removeDestroyed() {
+        size_t kept = 0;
+        for (size_t i = 0; i < size(); i++) {
+            if (shouldBeDestroyed[i]) continue;
+            positionX[kept] = positionX[i];
+            positionY[kept] = positionY[i];
+            previousX[kept] = previousX[i];
+            previousY[kept] = previousY[i];
+            velocityY[kept] = velocityY[i];
+            kinds[kept] = kinds[i];
+            isLeftOfPlayer[kept] = isLeftOfPlayer[i];
+            shouldBeDestroyed[kept] = 0;
+            kept++;
+        }
+        resize(kept);
+    }
+    void clear() {
+        resize(0);
+    }
+    // Fresh food first and spoilt food on top.
+    void submit(RenderQueue &renderQueue, float alpha) {
+        for (int isSpoilt = 0; isSpoilt <= 1; isSpoilt++) {
+            TextureKey texture = isSpoilt ? TextureKey::BAD_FOOD_SPRITE_SHEET : TextureKey::GOOD_FOOD_SPRITE_SHEET;
+            for (size_t i = 0; i < size(); i++) {
+                const FoodKindInfo &info = FOOD_KINDS[kinds[i]];
+                if (info.isSpoilt != static_cast<bool>(isSpoilt)) continue;
+                Rectangle src = {info.spriteSheetIndex * FOOD_SIZE, 0, FOOD_SIZE, FOOD_SIZE};
+                Rectangle dest = {Lerp(previousX[i], positionX[i], alpha), Lerp(previousY[i], positionY[i], alpha), FOOD_SIZE, FOOD_SIZE};
+                renderQueue.submit(RenderLayer::FOOD, texture, src, dest);
+            }
+        }
     }
-
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureBadFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
+    void drawDebugLines() {
+        for (size_t i = 0; i < size(); i++) {
+            DrawRectangleLinesEx({positionX[i], positionY[i], FOOD_SIZE, FOOD_SIZE}, 2, RED);
+            DrawCircleV({positionX[i], positionY[i]}, 3, BLUE);
+        }
     }
-};
-
-class SpoiltPotion : public BadFood{
-public: 
-    SpoiltPotion(Vector2 position, float speed) {
-        this->position = position;
-        this->size = {80.0f, 80.0f};
-        this->harmValue = 100.0f;
-        this->spriteSheetIndex = 5;
-        this->velocityY = speed * DEFAULT_FPS;
+    template <typename Stream>
+    void snapshot(Stream &stream) {
+        stream.field(positionX);
+        stream.field(positionY);
+        stream.field(previousX);
+        stream.field(previousY);
+        stream.field(velocityY);
+        stream.field(kinds);
+        stream.field(isLeftOfPlayer);
+        stream.field(shouldBeDestroyed);
+    }
+
+private:
+    void resize(size_t count) {
+        positionX.resize(count);
+        positionY.resize(count);
+        previousX.resize(count);
+        previousY.resize(count);
+        velocityY.resize(count);
+        kinds.resize(count);
+        isLeftOfPlayer.resize(count);
+        shouldBeDestroyed.resize(count);
     }
+};
 
-    void draw() override {
-        Rectangle src = {spriteSheetIndex * size.x, 0, size.x, size.y};
-        Rectangle dest = {position.x, position.y, size.x, size.y};
-        DrawTexturePro(textureBadFoodSpriteSheet, src, dest, {0, 0}, 0, WHITE);
-    }
+// What the Tab overlay times. FRAME is everything in a frame but EndDrawing, which
+// includes waiting for the frame limiter and so is listed apart.
+enum ProfileSection {
+    PROFILE_FRAME,
+    PROFILE_UPDATE,
+    PROFILE_FOODS,
+    PROFILE_PROJECTILES,
+    PROFILE_ENEMIES,
+    PROFILE_BUDDIES,
+    PROFILE_REMOVAL,
+    PROFILE_GARBAGE_COLLECTION,
+    PROFILE_COLLISIONS,
+    PROFILE_REWIND,
+    PROFILE_DRAW,
+    PROFILE_END_DRAWING,
+    NUM_PROFILE_SECTIONS,
 };
+const char *const profileSectionNames[NUM_PROFILE_SECTIONS] = {
+    "frame", "update", "foods", "projectiles", "enemies", "buddies", "checkForRemoval",
+    "garbageCollect", "checkForCollisions", "recordRewind", "draw", "EndDrawing",
+};
+constexpr float FRAME_BUDGET_MS = 1000.0f / FPS;
+
+// --trace <file> writes the profiled sections, spawns, state changes and purchases as a
+// Chrome trace. Building with -DFALLING_FEAST_TRACING=0 compiles every trace point out.
+#ifndef FALLING_FEAST_TRACING
+#define FALLING_FEAST_TRACING 1
+#endif
+#if FALLING_FEAST_TRACING
+Tracing::TraceWriter traceWriter;
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) Tracing::Scope TRACE_CONCAT(traceScope, __LINE__)(traceWriter, name)
+#define TRACE_INSTANT(name, value) traceWriter.instant(name, value)
+#else
+// sizeof keeps the arguments used without evaluating them.
+#define TRACE_SCOPE(name) ((void)sizeof(name))
+#define TRACE_INSTANT(name, value) ((void)sizeof((name), (value)))
+#endif
 
 class Game {
 public:
+    // Each runs on its mode's clock, so it stops while that mode is paused or not shown.
+    GameTimers collectingTimers;
+    GameTimers fightingTimers;
+    std::vector<TimerPayload> expiredTimers;
+    Timers::TimerHandle spawnTimer;
     Player player;
     std::unique_ptr<Bow> playerBow;
-    std::vector<std::unique_ptr<GoodFood>> goodFoods;
-    std::vector<std::unique_ptr<BadFood>> badFoods;
-    std::vector<Projectile> projectiles;
-    std::vector<std::unique_ptr<Enemy>> enemies;
-    std::vector<std::unique_ptr<BroccoliBuddy>> broccoliBuddies;
+    FoodPool foods = FoodPool(FOOD_POOL_CAPACITY);
+    ProjectilePool projectiles = ProjectilePool(PROJECTILE_POOL_CAPACITY);
+    EnemyPool enemies;
+    BroccoliBuddyPool broccoliBuddies;
+    TargetSelector targetSelector;
     std::vector<Coin> coins;
+    std::vector<GameEvent> events;
+    InputState guiInput;
+    RenderQueue renderQueue = RenderQueue(FOOD_POOL_CAPACITY + PROJECTILE_POOL_CAPACITY);
+    Collision::UniformGrid collisionGrid = Collision::UniformGrid({-200.0f, -200.0f, WINDOW_WIDTH + 400.0f, WINDOW_HEIGHT + 400.0f}, 100.0f);
+    int numCollisionPairs = 0;
+    // Scratch space for the narrow phase, one per chunk of the parallel enemy loop.
+    struct ProjectileHits {
+        std::vector<int> candidates;
+        std::vector<Collision::OrientedBox> boxes;
+        std::vector<uint8_t> isHit;
+        std::vector<std::pair<uint32_t, int>> enemyHits;
+        int numPairs = 0;
+
+        void clear() {
+            enemyHits.clear();
+            numPairs = 0;
+        }
+    };
+    std::vector<ProjectileHits> projectileHits;
+    // Loops over entities are split into chunks run by jobs. Nothing a chunk does may
+    // touch shared state: what would (timers to schedule, hits to apply) goes into the
+    // chunk's own buffer, and the buffers are merged in chunk order once the loop is
+    // done, which gives the same result as running the chunks one after another.
+    std::unique_ptr<Jobs::JobSystem> jobs;
+    std::vector<std::vector<uint32_t>> chunkArrivals;
+    Profiling::FrameProfiler profiler = Profiling::FrameProfiler(std::vector<const char *>(std::begin(profileSectionNames), std::end(profileSectionNames)));
     double dt = 0;
     double timeElapsed = 0;
     double collectingTimeElapsed = 0;
@@ -747,12 +2010,37 @@ public:
     int groundSpriteSheetIndex = 0;
     int maxGroundSprites;
 
-    double spawnTimer = 0.0f;
     double spawnInterval = 2.0f;
 
     bool shouldSpawnFood = false;
     bool isPaused = false;
+    int musicTrack = -1;
+    bool isMusicPaused = false;
     bool isDebugging = false;
+    bool isHeadless = false;
+    unsigned int seed;
+
+    // One stream per subsystem, so e.g. spawning more food does not change enemy damage.
+    enum RandomStream {
+        FOOD_STREAM,
+        ENEMY_STREAM,
+        COMBAT_STREAM,
+        BUDDY_STREAM,
+        PURCHASE_STREAM,
+    };
+    Random::Xoshiro128 foodRandom;
+    Random::Xoshiro128 enemyRandom;
+    Random::Xoshiro128 combatRandom;
+    Random::Xoshiro128 buddyRandom;
+    Random::Xoshiro128 purchaseRandom;
+    std::vector<float> spawnRolls;
+    Snapshots::Writer restoreBackup;
+    // Every tick's state, for scrubbing back through in debug mode. While scrubbing the
+    // simulation stands still on rewindIndex, and carrying on drops the ticks after it.
+    Rewind::History rewind = Rewind::History(REWIND_BUDGET_BYTES, REWIND_KEYFRAME_INTERVAL);
+    Snapshots::Writer rewindWriter;
+    bool isScrubbing = false;
+    size_t rewindIndex = 0;
 
     enum class GameState {
         TITLE_SCREEN,
@@ -762,12 +2050,16 @@ public:
 
     GameState gameState = GameState::TITLE_SCREEN;
     int gameStateIndex = 0;
-    int prevGameStateIndex = 0;
     int numEnemiesToSpawn = 5;
+    static constexpr size_t FOOD_GRAIN_SIZE = 4096;
+    static constexpr size_t PROJECTILE_GRAIN_SIZE = 1024;
+    static constexpr size_t ENEMY_GRAIN_SIZE = 256;
+    static constexpr size_t ENEMY_COLLISION_GRAIN_SIZE = 64;
 
     Rectangle startButtonBounds = {380, 555, 240, 100};
     Rectangle pausePlayButtonBounds = {30, WINDOW_HEIGHT - 80, 50, 50};
     Rectangle gameModeMenuBounds = {700, 650, 200, 50};
+    Rectangle newGameButtonBounds = {700, 590, 200, 50};
     Rectangle changeBackgroundButtonBounds = {WINDOW_WIDTH - 250.0f, WINDOW_HEIGHT - 150.0f, 200.0f, 40.0f};
     Rectangle titleScreenButtonBounds = {WINDOW_WIDTH - 250.0f, WINDOW_HEIGHT - 90.0f, 200.0f, 40.0f};
 
@@ -777,45 +2069,90 @@ public:
         {500.0f, WINDOW_HEIGHT + 100.0f}
     };
 
-    Game() {
-        SetRandomSeed(static_cast<unsigned int>(std::chrono::high_resolution_clock::now().time_since_epoch().count()));
-        InitAudioDevice();
-        loadMedia();
-        PlayMusicStream(musicCollectingBackground);
-        PlayMusicStream(musicFightingBackground);
+    Game(bool isHeadless = false) : Game(isHeadless, static_cast<unsigned int>(std::chrono::high_resolution_clock::now().time_since_epoch().count())) {}
+    // All of the simulation's randomness comes from the streams seeded here, so the seed
+    // plus the per-tick input fully determine a run.
+    Game(bool isHeadless, unsigned int seed) {
+        this->isHeadless = isHeadless;
+        this->seed = seed;
+        this->jobs = std::make_unique<Jobs::JobSystem>(std::thread::hardware_concurrency());
+        // Only the windowed game has an overlay to show the timings on.
+        this->profiler.isEnabled = !isHeadless;
+        foodRandom.seed(seed, FOOD_STREAM);
+        enemyRandom.seed(seed, ENEMY_STREAM);
+        combatRandom.seed(seed, COMBAT_STREAM);
+        buddyRandom.seed(seed, BUDDY_STREAM);
+        purchaseRandom.seed(seed, PURCHASE_STREAM);
+        if (isHeadless) {
+            loadMediaHeadless();
+        } else {
+            loadMedia();
+            loadVoices();
+            std::vector<Music> tracks;
+            for (Music *music: musicStreams) tracks.push_back(*music);
+            musicThread.start(tracks);
+        }
         player = Player();
-        playerBow = std::make_unique<Bow>(&player.position, nullptr, true, false, &player.level);
+        playerBow = std::make_unique<Bow>(&player.position, &player.level);
+        enemies = EnemyPool();
+        broccoliBuddies = BroccoliBuddyPool();
+
+        spawnTimer = collectingTimers.schedule(secondsToTicks(spawnInterval), {TimerKind::SPAWN_FOOD});
 
         maxTerrainSprites = textureTerrainSpriteSheet.width / 1000;
         maxGroundSprites = textureGroundSpriteSheet.width / 1000;
-        setGuiStyles();
+        if (!isHeadless) setGuiStyles();
     }
 
-    void draw() {
+    // Queues every sprite of the current screen. draw() flushes them to the window; headless
+    // runs flush without drawing to measure batching.
+    void submitSprites(float alpha) {
+        Rectangle screen = {0, 0, (float)WINDOW_WIDTH, (float)WINDOW_HEIGHT};
+        if (gameState == GameState::TITLE_SCREEN) {
+            renderQueue.submit(RenderLayer::BACKGROUND, TextureKey::TITLE_SCREEN, screen, screen);
+            return;
+        }
+        if (gameState == GameState::COLLECTING_FOOD) {
+            renderQueue.submit(RenderLayer::BACKGROUND, TextureKey::TERRAIN_SPRITE_SHEET, {terrainSpriteSheetIndex * 1000.0f, 0, 1000, 800}, screen);
+            foods.submit(renderQueue, alpha);
+            player.submit(renderQueue, gameStateIndex, alpha);
+        } else if (gameState == GameState::FIGHTING) {
+            renderQueue.submit(RenderLayer::BACKGROUND, TextureKey::GROUND_SPRITE_SHEET, {groundSpriteSheetIndex * 1000.0f, 0, 1000, 800}, screen);
+            player.submit(renderQueue, gameStateIndex, alpha);
+            playerBow->submit(renderQueue, alpha);
+            enemies.submit(renderQueue, alpha);
+            broccoliBuddies.submit(renderQueue, alpha);
+            projectiles.submit(renderQueue, alpha);
+            for (auto &coin: coins) {
+                coin.submit(renderQueue);
+            }
+        }
+        int pausePlayButtonIndex = isPaused ? 1 : 0;
+        Rectangle src = {pausePlayButtonIndex * pausePlayButtonBounds.width, 0, pausePlayButtonBounds.width, pausePlayButtonBounds.height};
+        renderQueue.submit(RenderLayer::HUD, TextureKey::PAUSE_PLAY_BUTTON_SPRITE_SHEET, src, pausePlayButtonBounds);
+    }
+    void draw(float alpha) {
+        Profiling::Scope profile(profiler, PROFILE_DRAW);
+        TRACE_SCOPE(profileSectionNames[PROFILE_DRAW]);
+        submitSprites(alpha);
+        renderQueue.flush(true);
         if (gameState == GameState::TITLE_SCREEN) {
-            DrawTexture(textureTitleScreen, 0, 0, WHITE);
-            GuiComboBox(gameModeMenuBounds, "Collect;Fighting", &gameStateIndex);
-            if (prevGameStateIndex != gameStateIndex) {
-                PlaySound(soundClick);
-                prevGameStateIndex = gameStateIndex;
+            int selectedGameStateIndex = gameStateIndex;
+            GuiComboBox(gameModeMenuBounds, "Collect;Fighting", &selectedGameStateIndex);
+            if (selectedGameStateIndex != gameStateIndex) {
+                guiInput.selectedGameStateIndex = selectedGameStateIndex;
+            }
+            if (GuiButton(newGameButtonBounds, "New Game")) {
+                guiInput.isNewGameClicked = true;
             }
         } else if (gameState == GameState::COLLECTING_FOOD) {
-            Rectangle src = {terrainSpriteSheetIndex * 1000.0f, 0, 1000, 800};
-            Rectangle dest = {0, 0, 1000, 800};
-            DrawTexturePro(textureTerrainSpriteSheet, src, dest, {0, 0}, 0, WHITE);
-            for (auto &goodFood: goodFoods) {
-                goodFood->draw();
-                if (isDebugging) goodFood->drawDebugLines();
-            }
-            for (auto &badFood: badFoods) {
-                badFood->draw();
-                if (isDebugging) badFood->drawDebugLines();
-            }
-            player.draw(gameStateIndex);
-            if (isDebugging) player.drawDebugLines();
-            DrawTextEx(font, TextFormat("Nutrition: %.0f", player.nutrition), {40, 40}, 35, 2, terrainSpriteSheetIndex == 4 ? WHITE : BLACK);
+            if (isDebugging) {
+                foods.drawDebugLines();
+                player.drawDebugLines();
+            }
+            numberText.draw(font, "Nutrition: %i", (int)roundf(player.nutrition), {40, 40}, 35, 2, terrainSpriteSheetIndex == 4 ? WHITE : BLACK);
             
-            float levelMeter = (collectingTimeElapsed - spawnTimer) / spawnInterval * 250.0f;
+            float levelMeter = Clamp(1.0f - collectingTimers.getRemaining(spawnTimer) * TICK_TIME / spawnInterval, 0.0f, 1.0f) * 250.0f;
 
             DrawRectangleV({WINDOW_WIDTH - 300.0f, 40.0f}, {250.0f, 50.0f}, GRAY);
             DrawRectangleGradientV(WINDOW_WIDTH - 300.0f, 40.0f, levelMeter, 50.0f, BLUE, {0, 255, 255, 255});
@@ -824,15 +2161,12 @@ public:
 
             if (player.nutrition < 1000) GuiDisable();
             if (GuiButton({WINDOW_WIDTH - 300.0f, 120.0f, 150.0f, 50.0f}, "Purchase")) {
-                PlaySound(soundKaching);
-                player.nutrition -= 1000.0f;
-                player.attractionTimer = collectingTimeElapsed;
-                player.isAttracting = true;
+                guiInput.isPurchaseClicked = true;
             }
             GuiEnable();
 
             if (player.isAttracting) {
-                float remaining = player.powerUpDuration - (collectingTimeElapsed - player.attractionTimer);
+                float remaining = collectingTimers.getRemaining(player.attractionTimer) * TICK_TIME;
                 levelMeter = (remaining / player.powerUpDuration) * 250.0f;
                 levelMeter = Clamp(levelMeter, 0.0f, 250.0f);
                 DrawRectangleV({40.0f, 300.0f}, {250.0f, 25.0f}, GRAY);
@@ -841,85 +2175,57 @@ public:
                 DrawTextEx(font, "Attraction Timer", {50.0f, 302.0f}, 25.0f, 0.0f, BLACK);
             }
         } else if (gameState == GameState::FIGHTING) {
-            Rectangle src = {groundSpriteSheetIndex * 1000.0f, 0, 1000, 800};
-            Rectangle dest = {0, 0, 1000, 800};
-            DrawTexturePro(textureGroundSpriteSheet, src, dest, {0, 0}, 0, WHITE);
-            
             int integerLevel = static_cast<int>(player.level);
             float levelMeter = (player.level - integerLevel) * 250.0f;
-            
-            player.draw(gameStateIndex);
-            if (isDebugging) player.drawDebugLines();
-            playerBow->draw();
-            if (isDebugging) playerBow->drawDebugLines();
-            for (auto &enemy: enemies) {
-                enemy->draw();
-                if (isDebugging) enemy->drawDebugLines();
-                enemy->associatedBow->draw();
-                if (isDebugging) enemy->associatedBow->drawDebugLines();
-            }
-            for (auto &broccoliBuddy: broccoliBuddies) {
-                broccoliBuddy->draw(fightingTimeElapsed);
-                if (isDebugging) broccoliBuddy->drawDebugLines();
-                broccoliBuddy->associatedBow->draw();
-                if (isDebugging) broccoliBuddy->associatedBow->drawDebugLines();
-            }
-            for (auto &projectile: projectiles) {
-                projectile.draw();
-                if (isDebugging) projectile.drawDebugLines();
-            }
-            for (auto &coin: coins) {
-                coin.draw();
-                if (isDebugging) coin.drawDebugLines();
+
+            enemies.drawLabels(alpha);
+            broccoliBuddies.drawLabels(fightingTimers, alpha);
+            if (isDebugging) {
+                player.drawDebugLines();
+                playerBow->drawDebugLines();
+                enemies.drawDebugLines();
+                broccoliBuddies.drawDebugLines();
+                projectiles.drawDebugLines();
+                for (auto &coin: coins) {
+                    coin.drawDebugLines();
+                }
             }
-            DrawTextEx(font, TextFormat("Nutrition: %.0f", player.nutrition), {50, 110}, 35, 2, BLACK);
-            DrawTextEx(font, TextFormat("Coins: %i", player.coins), {WINDOW_WIDTH - 500.0f, 120.0f}, 35.0f, 2, BLACK);
+            numberText.draw(font, "Nutrition: %i", (int)roundf(player.nutrition), {50, 110}, 35, 2, BLACK);
+            numberText.draw(font, "Coins: %i", player.coins, {WINDOW_WIDTH - 500.0f, 120.0f}, 35.0f, 2, BLACK);
 
             DrawRectangleV({WINDOW_WIDTH - 300.0f, 40.0f}, {250.0f, 50.0f}, GRAY);
             DrawRectangleGradientV(WINDOW_WIDTH - 300.0f, 40.0f, levelMeter, 50.0f, ORANGE, YELLOW);
             DrawRectangleLinesEx({WINDOW_WIDTH - 300.0f, 40.0f, 250.0f, 50.0f}, 3, BLACK);
-            DrawTextEx(font, TextFormat("Level: %d", integerLevel), {WINDOW_WIDTH - 280.0f, 55.0f}, 30.0f, 1.5f, BLACK);
+            numberText.draw(font, "Level: %i", integerLevel, {WINDOW_WIDTH - 280.0f, 55.0f}, 30.0f, 1.5f, BLACK);
 
             levelMeter = player.health / player.maxHealth * 300.0f;
             DrawRectangleV({50.0f, 40.0f}, {300.0f, 50.0f}, GRAY);
             DrawRectangleGradientV(50.0f, 40.0f, levelMeter, 50.0f, RED, MAROON);
             DrawRectangleLinesEx({50.0f, 40.0f, 300.0f, 50.0f}, 3, BLACK);
-            DrawTextEx(font, TextFormat("Health: %d", (int)player.health), {70.0f, 55.0f}, 30.0f, 1.5f, BLACK);
+            numberText.draw(font, "Health: %i", (int)player.health, {70.0f, 55.0f}, 30.0f, 1.5f, BLACK);
 
             if (player.nutrition <= 0) {
                 GuiDisable();
             }
             if (GuiButton({WINDOW_WIDTH - 300.0f, 120.0f, 150.0f, 50.0f}, "Level Up")) {
-                PlaySound(soundLevelUp);
-                player.level += player.nutrition / 500.0f;
-                player.nutrition = 0;
+                guiInput.isLevelUpClicked = true;
             }
             GuiEnable();
 
             if (player.coins < 15) GuiDisable();
             if (GuiButton({WINDOW_WIDTH - 500.0f, 40.0f, 150.0f, 50.0f}, "Purchase")) {
-                PlaySound(soundKaching);
-                player.coins -= 15;
-                if (GetRandomValue(0, 1)) {
-                    player.isExtraFast = true;
-                    player.speedTimer = fightingTimeElapsed;
-                } else {
-                    player.isImmune = true;
-                    player.immunityTimer = fightingTimeElapsed;
-                }
+                guiInput.isPurchaseClicked = true;
             }
             GuiEnable();
 
             if (player.coins < 20) GuiDisable();
             if (GuiButton({50.0f, 180.0f, 300.0f, 35.0f}, "Buy Broccoli Buddy")) {
-                player.coins -= 20;
-                PlaySound(soundKaching);
-                spawnBroccoliBuddy();
+                guiInput.isBuyBroccoliBuddyClicked = true;
             }
             GuiEnable();
 
             if (player.isExtraFast) {
-                float remaining = player.powerUpDuration - (fightingTimeElapsed - player.speedTimer);
+                float remaining = fightingTimers.getRemaining(player.speedTimer) * TICK_TIME;
                 levelMeter = (remaining / player.powerUpDuration) * 250.0f;
                 levelMeter = Clamp(levelMeter, 0.0f, 250.0f);
                 DrawRectangleV({40.0f, 300.0f}, {250.0f, 25.0f}, GRAY);
@@ -928,7 +2234,7 @@ public:
                 DrawTextEx(font, "Speed Timer", {50.0f, 302.0f}, 25.0f, 0.0f, BLACK);
             }
             if (player.isImmune) {
-                float remaining = player.powerUpDuration - (fightingTimeElapsed - player.immunityTimer);
+                float remaining = fightingTimers.getRemaining(player.immunityTimer) * TICK_TIME;
                 levelMeter = (remaining / player.powerUpDuration) * 250.0f;
                 levelMeter = Clamp(levelMeter, 0.0f, 250.0f);
                 DrawRectangleV({40.0f, 350.0f}, {250.0f, 25.0f}, GRAY);
@@ -938,50 +2244,168 @@ public:
             }
         }
         if (gameState != GameState::TITLE_SCREEN) {
-            int pausePlayButtonIndex = isPaused ? 1 : 0;
-            Rectangle src = {pausePlayButtonIndex * pausePlayButtonBounds.width, 0, pausePlayButtonBounds.width, pausePlayButtonBounds.height};
-            Rectangle dest = {pausePlayButtonBounds.x, pausePlayButtonBounds.y, pausePlayButtonBounds.width, pausePlayButtonBounds.height};
-            DrawTexturePro(texturePausePlayButtonSpriteSheet, src, dest, {0, 0}, 0, WHITE);
-
             if (GuiButton(titleScreenButtonBounds, "Title Screen")) {
-                PlaySound(soundClick);
-                gameState = GameState::TITLE_SCREEN;
+                guiInput.isTitleScreenClicked = true;
             }
             if (GuiButton(changeBackgroundButtonBounds, "Change BG")) {
-                PlaySound(soundClick);
-                if (gameState == GameState::COLLECTING_FOOD) {
-                    terrainSpriteSheetIndex = (terrainSpriteSheetIndex + 1) % maxTerrainSprites;
-                } else if (gameState == GameState::FIGHTING) {
-                    groundSpriteSheetIndex = (groundSpriteSheetIndex + 1) % maxGroundSprites;
+                guiInput.isChangeBackgroundClicked = true;
+            }
+        }
+        if (isDebugging) drawProfilerOverlay();
+    }
+    // Frame times for the last few seconds against the frame budget, what each section
+    // costs, and how much there is of everything. Shows the frames before this one.
+    void drawProfilerOverlay() {
+        Rectangle panel = {10.0f, 380.0f, 440.0f, 384.0f};
+        DrawRectangleRec(panel, Fade(BLACK, 0.7f));
+
+        Rectangle graph = {panel.x + 10.0f, panel.y + 10.0f, 420.0f, 80.0f};
+        float graphMaxMs = 2.0f * FRAME_BUDGET_MS;
+        float barWidth = graph.width / Profiling::FrameProfiler::HISTORY_SIZE;
+        for (int i = 0; i < Profiling::FrameProfiler::HISTORY_SIZE; i++) {
+            float frameMs = profiler.get(PROFILE_FRAME, i);
+            float height = std::min(frameMs / graphMaxMs, 1.0f) * graph.height;
+            float x = graph.x + graph.width - (i + 1) * barWidth;
+            DrawRectangleRec({x, graph.y + graph.height - height, barWidth, height}, frameMs > FRAME_BUDGET_MS ? RED : GREEN);
+        }
+        float budgetY = graph.y + graph.height / 2.0f;
+        DrawLineV({graph.x, budgetY}, {graph.x + graph.width, budgetY}, YELLOW);
+        DrawRectangleLinesEx(graph, 1.0f, GRAY);
+
+        float y = graph.y + graph.height + 8.0f;
+        DrawText("section (ms)            last    avg    max", (int)graph.x, (int)y, 16, LIGHTGRAY);
+        y += 18.0f;
+        for (int section = 0; section < NUM_PROFILE_SECTIONS; section++) {
+            DrawText(profileSectionNames[section], (int)graph.x, (int)y, 16, WHITE);
+            DrawText(TextFormat("%6.2f %6.2f %6.2f", profiler.get(section, 0), profiler.getAverage(section, FPS), profiler.getMax(section, FPS)), (int)graph.x + 200, (int)y, 16, WHITE);
+            y += 16.0f;
+        }
+        y += 4.0f;
+        DrawText(TextFormat("foods %i  arrows %i  enemies %i  buddies %i  coins %i", (int)foods.size(), (int)projectiles.size(), (int)enemies.size(), (int)broccoliBuddies.size(), (int)coins.size()), (int)graph.x, (int)y, 16, WHITE);
+        y += 18.0f;
+        DrawText(TextFormat("collision pairs %i  threads %i  fps %i", numCollisionPairs, jobs->getNumThreads(), GetFPS()), (int)graph.x, (int)y, 16, WHITE);
+        y += 18.0f;
+        float rewindRatio = rewind.getNumBytes() > 0 ? (float)rewind.getNumRawBytes() / rewind.getNumBytes() : 0.0f;
+        DrawText(TextFormat("rewind %.1f s  %.2f of %.0f MB  %.1fx smaller", (float)rewind.size() / TICK_RATE, rewind.getNumBytes() / 1048576.0f, rewind.budgetBytes / 1048576.0f, rewindRatio), (int)graph.x, (int)y, 16, WHITE);
+        y += 18.0f;
+        if (isScrubbing) {
+            DrawText(TextFormat("scrubbing %.2f s back  Left/Right step  R carries on", (float)(rewind.size() - 1 - rewindIndex) / TICK_RATE), (int)graph.x, (int)y, 16, YELLOW);
+        } else {
+            DrawText("R to scrub back through the rewind buffer", (int)graph.x, (int)y, 16, LIGHTGRAY);
+        }
+    }
+    // Merges the GUI clicks recorded by the last draw() into this frame's input.
+    InputState takeGuiInput(InputState input) {
+        input.selectedGameStateIndex = guiInput.selectedGameStateIndex;
+        input.isTitleScreenClicked = guiInput.isTitleScreenClicked;
+        input.isChangeBackgroundClicked = guiInput.isChangeBackgroundClicked;
+        input.isPurchaseClicked = guiInput.isPurchaseClicked;
+        input.isLevelUpClicked = guiInput.isLevelUpClicked;
+        input.isBuyBroccoliBuddyClicked = guiInput.isBuyBroccoliBuddyClicked;
+        input.isNewGameClicked = guiInput.isNewGameClicked;
+        guiInput = InputState();
+        return input;
+    }
+    void applyGuiInput(const InputState &input) {
+        if (gameState == GameState::TITLE_SCREEN) {
+            if (input.selectedGameStateIndex >= 0 && input.selectedGameStateIndex != gameStateIndex) {
+                events.push_back(GameEvent::BUTTON_CLICKED);
+                gameStateIndex = input.selectedGameStateIndex;
+            }
+            // Start carries on with what the player has; New Game throws it away.
+            if (input.isNewGameClicked) {
+                events.push_back(GameEvent::BUTTON_CLICKED);
+                int selectedGameStateIndex = gameStateIndex;
+                reset();
+                gameStateIndex = selectedGameStateIndex;
+            }
+            return;
+        }
+        if (gameState == GameState::COLLECTING_FOOD) {
+            if (input.isPurchaseClicked && player.nutrition >= 1000) {
+                events.push_back(GameEvent::PURCHASED);
+                player.nutrition -= 1000.0f;
+                TRACE_INSTANT("purchaseAttraction", (int64_t)player.nutrition);
+                collectingTimers.cancel(player.attractionTimer);
+                player.attractionTimer = collectingTimers.schedule(secondsToTicks(player.powerUpDuration), {TimerKind::ATTRACTION_OVER});
+                player.isAttracting = true;
+            }
+        } else if (gameState == GameState::FIGHTING) {
+            if (input.isLevelUpClicked && player.nutrition > 0) {
+                events.push_back(GameEvent::LEVELED_UP);
+                player.level += player.nutrition / 500.0f;
+                player.nutrition = 0;
+                TRACE_INSTANT("levelUp", (int64_t)player.level);
+            }
+            if (input.isPurchaseClicked && player.coins >= 15) {
+                events.push_back(GameEvent::PURCHASED);
+                player.coins -= 15;
+                if (purchaseRandom.nextBool()) {
+                    player.isExtraFast = true;
+                    TRACE_INSTANT("purchaseSpeed", player.coins);
+                    fightingTimers.cancel(player.speedTimer);
+                    player.speedTimer = fightingTimers.schedule(secondsToTicks(player.powerUpDuration), {TimerKind::SPEED_OVER});
+                } else {
+                    player.isImmune = true;
+                    TRACE_INSTANT("purchaseImmunity", player.coins);
+                    fightingTimers.cancel(player.immunityTimer);
+                    player.immunityTimer = fightingTimers.schedule(secondsToTicks(player.powerUpDuration), {TimerKind::IMMUNITY_OVER});
                 }
             }
+            if (input.isBuyBroccoliBuddyClicked && player.coins >= 20) {
+                player.coins -= 20;
+                events.push_back(GameEvent::PURCHASED);
+                TRACE_INSTANT("purchaseBroccoliBuddy", player.coins);
+                spawnBroccoliBuddy();
+            }
+        }
+        if (input.isTitleScreenClicked) {
+            events.push_back(GameEvent::BUTTON_CLICKED);
+            setGameState(GameState::TITLE_SCREEN);
+        }
+        if (input.isChangeBackgroundClicked) {
+            events.push_back(GameEvent::BUTTON_CLICKED);
+            if (gameState == GameState::COLLECTING_FOOD) {
+                terrainSpriteSheetIndex = (terrainSpriteSheetIndex + 1) % maxTerrainSprites;
+            } else if (gameState == GameState::FIGHTING) {
+                groundSpriteSheetIndex = (groundSpriteSheetIndex + 1) % maxGroundSprites;
+            }
         }
     }
-    void update() {
-        Vector2 mousePos = GetMousePosition();
+    // Snapshot of where everything was before this tick, which draw() interpolates from.
+    void savePreviousState() {
+        player.previousPosition = player.position;
+        playerBow->previousPosition = playerBow->position;
+        foods.savePreviousPositions();
+        projectiles.savePreviousPositions();
+        enemies.savePreviousPositions();
+        broccoliBuddies.savePreviousPositions();
+    }
+    void update(const InputState &input, float tickTime) {
+        Profiling::Scope profile(profiler, PROFILE_UPDATE);
+        TRACE_SCOPE(profileSectionNames[PROFILE_UPDATE]);
+        Vector2 mousePos = input.mousePosition;
+        savePreviousState();
 
         if (!isPaused) {
-            dt = GetFrameTime();
+            dt = tickTime;
             timeElapsed += dt;
-            if (IsKeyPressed(KEY_TAB)) {
+            if (input.isDebugTogglePressed) {
                 isDebugging = !isDebugging;
             }
         }
+        applyGuiInput(input);
 
         if (gameState == GameState::TITLE_SCREEN) {
-            if (CheckCollisionPointRec(mousePos, startButtonBounds) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-                PlaySound(soundClick);
-                gameState = static_cast<GameState>(gameStateIndex + 1);
+            if (CheckCollisionPointRec(mousePos, startButtonBounds) && input.isMouseLeftPressed) {
+                events.push_back(GameEvent::BUTTON_CLICKED);
+                setGameState(static_cast<GameState>(gameStateIndex + 1));
             }
         } else if (gameState == GameState::COLLECTING_FOOD && !isPaused) {
             collectingTimeElapsed += dt;
-            UpdateMusicStream(musicCollectingBackground);
-
-            if (collectingTimeElapsed - spawnTimer >= spawnInterval) {
-                shouldSpawnFood = true;
-                spawnTimer = collectingTimeElapsed;
-            }
-            if (IsKeyPressed(KEY_G)) {
+            collectingTimers.advance(expiredTimers);
+            dispatchExpiredTimers();
+            if (input.isChangeBackgroundPressed) {
                 terrainSpriteSheetIndex = (terrainSpriteSheetIndex + 1) % maxTerrainSprites;
             }
             
@@ -1001,109 +2425,78 @@ public:
                 spawnNumber = 1;
             }
 
-            if (player.isAttracting) {
-                for (auto &food: goodFoods) {
-                    if (food->isLeftOfPlayer) {
-                        food->position.x += 1.0f * (DEFAULT_FPS * dt);
-                        if (food->position.x + food->size.x / 2 > player.position.x + player.size.x / 2) {
-                            food->position.x--;
-                        }
-                    } else {
-                        food->position.x -= 1.0f * (DEFAULT_FPS * dt);
-                        if (food->position.x + food->size.x / 2 < player.position.x + player.size.x / 2) {
-                            food->position.x++;
-                        }
-                    }
-                }
-                for (auto &food: badFoods) {
-                    if (food->isLeftOfPlayer) {
-                        food->position.x -= 1.0f * (DEFAULT_FPS * dt);
-                    } else {
-                        food->position.x += 1.0f * (DEFAULT_FPS * dt);
-                    }
-                }
-
-                if (collectingTimeElapsed - player.attractionTimer >= player.powerUpDuration) {
-                    player.isAttracting = false;
-                }
-            }
-    
             spawnInterval = std::max(2.0f - player.nutrition / 3500.0f, 1.2f);
-    
-            for (auto &goodFood: goodFoods) {
-                goodFood->update(dt, timeElapsed);
-                bool isLeftOfPlayer = goodFood->position.x + goodFood->size.x / 2 <= player.position.x + player.size.x / 2;
-                goodFood->isLeftOfPlayer = isLeftOfPlayer;
-            }
-            for (auto &badFood: badFoods) {
-                badFood->update(dt, timeElapsed);
-                bool isLeftOfPlayer = badFood->position.x + badFood->size.x / 2 <= player.position.x + player.size.x / 2;
-                badFood->isLeftOfPlayer = isLeftOfPlayer;
+
+            Profiling::Scope profileFoods(profiler, PROFILE_FOODS);
+            TRACE_SCOPE(profileSectionNames[PROFILE_FOODS]);
+            if (player.isAttracting) {
+                foods.attract(player.position.x + player.size.x / 2, 1.0f * (DEFAULT_FPS * dt));
             }
+            float playerCenterX = player.position.x + player.size.x / 2;
+            jobs->parallelFor(foods.size(), FOOD_GRAIN_SIZE, [&](size_t /*chunk*/, size_t begin, size_t end) {
+                foods.update(dt, playerCenterX, begin, end);
+            });
         } else if (gameState == GameState::FIGHTING && !isPaused) {
             fightingTimeElapsed += dt;
-            UpdateMusicStream(musicFightingBackground);
+            fightingTimers.advance(expiredTimers);
+            dispatchExpiredTimers();
 
-            playerBow->update();
+            playerBow->update(input);
             if (enemies.empty()) {
                 spawnEnemies();
                 player.health = player.maxHealth;
                 projectiles.clear();
             }
-            if (IsKeyPressed(KEY_G)) {
+            if (input.isChangeBackgroundPressed) {
                 groundSpriteSheetIndex = (groundSpriteSheetIndex + 1) % maxGroundSprites;
             }
             if (playerBow->shouldShoot) {
-                projectiles.push_back(Projectile(playerBow->position, true, playerBow->angleDeg));
-                PlaySound(soundShoot);
-                playerBow->shouldShoot = false;
-            }
-            for (auto &projectile: projectiles) {
-                projectile.update(dt);
-            }
-            for (auto &enemy: enemies) {
-                enemy->update(dt, fightingTimeElapsed);
-                enemy->associatedBow->update();
-                if (enemy->shouldShoot) {
-                    projectiles.push_back(Projectile(enemy->associatedBow->position, false, enemy->associatedBow->angleDeg));
-                    PlaySound(soundShoot);
-                    enemy->shouldShoot = false;
+                if (projectiles.spawn(playerBow->position, true, playerBow->angleDeg)) {
+                    events.push_back(GameEvent::PROJECTILE_FIRED);
                 }
+                playerBow->shouldShoot = false;
             }
-            for (auto &broccoliBuddy: broccoliBuddies) {
-                broccoliBuddy->update(dt, fightingTimeElapsed);
-                broccoliBuddy->associatedBow->update();
-                if (broccoliBuddy->associatedBow->shouldShoot) {
-                    projectiles.push_back(Projectile(broccoliBuddy->associatedBow->position, true, broccoliBuddy->associatedBow->angleDeg));
-                    PlaySound(soundShoot);
-                    broccoliBuddy->associatedBow->shouldShoot = false;
-                }
+            {
+                Profiling::Scope profileProjectiles(profiler, PROFILE_PROJECTILES);
+                TRACE_SCOPE(profileSectionNames[PROFILE_PROJECTILES]);
+                jobs->parallelFor(projectiles.size(), PROJECTILE_GRAIN_SIZE, [&](size_t /*chunk*/, size_t begin, size_t end) {
+                    projectiles.update(dt, begin, end);
+                });
             }
-
-            if (player.isExtraFast) {
-                if (fightingTimeElapsed - player.speedTimer >= player.powerUpDuration) {
-                    player.isExtraFast = false;
+            {
+                Profiling::Scope profileEnemies(profiler, PROFILE_ENEMIES);
+                TRACE_SCOPE(profileSectionNames[PROFILE_ENEMIES]);
+                prepareChunkBuffers(chunkArrivals, enemies.size(), ENEMY_GRAIN_SIZE);
+                jobs->parallelFor(enemies.size(), ENEMY_GRAIN_SIZE, [&](size_t chunk, size_t begin, size_t end) {
+                    enemies.updateMovement(dt, player.position, begin, end, chunkArrivals[chunk]);
+                    enemies.updateBows(player.center, begin, end);
+                });
+                for (const std::vector<uint32_t> &arrivals: chunkArrivals) {
+                    enemies.scheduleFirstShots(arrivals, fightingTimeElapsed, fightingTimers);
                 }
+                fireBows(enemies.bows, false);
             }
-            if (player.isImmune) {
-                if (fightingTimeElapsed - player.immunityTimer >= player.powerUpDuration) {
-                    player.isImmune = false;
-                }
+            {
+                Profiling::Scope profileBuddies(profiler, PROFILE_BUDDIES);
+                TRACE_SCOPE(profileSectionNames[PROFILE_BUDDIES]);
+                if (broccoliBuddies.size() > 0) targetSelector.build(enemies);
+                broccoliBuddies.update(dt, enemies, targetSelector, playerBow->damage, fightingTimers);
+                fireBows(broccoliBuddies.bows, true);
             }
         }
         if (gameState != GameState::TITLE_SCREEN) {
-            if (CheckCollisionPointRec(mousePos, pausePlayButtonBounds) && IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-                PlaySound(soundClick);
+            if (CheckCollisionPointRec(mousePos, pausePlayButtonBounds) && input.isMouseLeftPressed) {
+                events.push_back(GameEvent::BUTTON_CLICKED);
                 isPaused = !isPaused;
             }
-            if (IsKeyPressed(KEY_T)) {
-                gameState = GameState::TITLE_SCREEN;
+            if (input.isTitleScreenPressed) {
+                setGameState(GameState::TITLE_SCREEN);
                 isPaused = false;
             }
-            if (!isPaused) player.update(dt, timeElapsed, gameStateIndex);
+            if (!isPaused) player.update(dt, timeElapsed, gameStateIndex, input);
             if (player.isDead) {
                 reset();
-                PlaySound(soundFail);
+                events.push_back(GameEvent::PLAYER_DIED);
             }
 
             checkForRemoval();
@@ -1111,179 +2504,322 @@ public:
             checkForCollisions();
         }
     }
-    void checkForRemoval() {
-        if (gameState == GameState::COLLECTING_FOOD) {
-            for (auto &goodFood: goodFoods) {
-                if (goodFood->position.y > WINDOW_HEIGHT) {
-                    goodFood->shouldBeDestroyed = true;
+    // Acts on the timers that went off this tick; the repeating ones schedule themselves again.
+    void dispatchExpiredTimers() {
+        for (const TimerPayload &timer: expiredTimers) {
+            switch (timer.kind) {
+                case TimerKind::SPAWN_FOOD:
+                    shouldSpawnFood = true;
+                    spawnTimer = collectingTimers.schedule(secondsToTicks(spawnInterval), timer);
+                    break;
+                case TimerKind::ATTRACTION_OVER: player.isAttracting = false; break;
+                case TimerKind::SPEED_OVER: player.isExtraFast = false; break;
+                case TimerKind::IMMUNITY_OVER: player.isImmune = false; break;
+                case TimerKind::ENEMY_SHOOT: {
+                    int32_t i = enemies.handleMap.find(timer.entity);
+                    if (i < 0) break;
+                    enemies.bows.shouldShoot[i] = 1;
+                    enemies.shootTimers[i] = fightingTimers.schedule(secondsToTicks(enemies.shootingCooldowns[i]), timer);
+                    break;
                 }
-            }
-            for (auto &badFood: badFoods) {
-                if (badFood->position.y > WINDOW_HEIGHT) {
-                    badFood->shouldBeDestroyed = true;
+                case TimerKind::BUDDY_SHOOT: {
+                    int32_t i = broccoliBuddies.handleMap.find(timer.entity);
+                    if (i < 0) break;
+                    broccoliBuddies.bows.shouldShoot[i] = 1;
+                    broccoliBuddies.shootTimers[i] = fightingTimers.schedule(secondsToTicks(broccoliBuddies.shootCooldowns[i]), timer);
+                    break;
+                }
+                case TimerKind::BUDDY_EXPIRED: {
+                    int32_t i = broccoliBuddies.handleMap.find(timer.entity);
+                    if (i >= 0) broccoliBuddies.shouldBeDestroyed[i] = 1;
+                    break;
                 }
             }
+        }
+        expiredTimers.clear();
+    }
+    void fireBows(BowArrays &bows, bool isPlayerSide) {
+        for (size_t i = 0; i < bows.size(); i++) {
+            if (!bows.shouldShoot[i]) continue;
+            if (projectiles.spawn(bows.getPosition(i), isPlayerSide, bows.anglesDeg[i])) {
+                events.push_back(GameEvent::PROJECTILE_FIRED);
+            }
+            bows.shouldShoot[i] = 0;
+        }
+    }
+    // Covers everything the simulation carries from one tick to the next that can drift:
+    // mode, clocks, player, food, enemies, buddies, projectiles and coins.
+    uint64_t computeStateHash() const {
+        Hashing::Fnv1a hash;
+        hash.add(gameState);
+        hash.add(timeElapsed);
+        for (const Random::Xoshiro128 *random: {&foodRandom, &enemyRandom, &combatRandom, &buddyRandom, &purchaseRandom}) {
+            hash.add(random->state);
+        }
+        hash.add(collectingTimers.now);
+        hash.add(fightingTimers.now);
+        hash.add(collectingTimers.getRemaining(spawnTimer));
+        hash.add(player.position);
+        hash.add(player.nutrition);
+        hash.add(player.health);
+        hash.add(player.level);
+        hash.add(player.coins);
+        hash.add(foods.positionX);
+        hash.add(foods.positionY);
+        hash.add(foods.kinds);
+        hash.add(enemies.positionX);
+        hash.add(enemies.positionY);
+        hash.add(enemies.health);
+        for (Timers::TimerHandle shootTimer: enemies.shootTimers) {
+            hash.add(fightingTimers.getRemaining(shootTimer));
+        }
+        hash.add(broccoliBuddies.positionX);
+        hash.add(broccoliBuddies.positionY);
+        hash.add(projectiles.positionX);
+        hash.add(projectiles.positionY);
+        hash.add(projectiles.velocityX);
+        hash.add(projectiles.velocityY);
+        for (const Coin &coin: coins) {
+            hash.add(coin.position);
+        }
+        return hash.value;
+    }
+    // Everything update() carries from one tick to the next. Scratch buffers, the grids and
+    // the render queue are rebuilt every tick, and the GUI, audio, debug and thread
+    // settings belong to the running session, so none of those are stored.
+    template <typename Stream>
+    void snapshot(Stream &stream) {
+        stream.field(gameState);
+        stream.field(gameStateIndex);
+        stream.field(seed);
+        stream.field(dt);
+        stream.field(timeElapsed);
+        stream.field(collectingTimeElapsed);
+        stream.field(fightingTimeElapsed);
+        stream.field(spawnNumber);
+        stream.field(numFoods);
+        stream.field(spawnInterval);
+        stream.field(shouldSpawnFood);
+        stream.field(isPaused);
+        stream.field(numEnemiesToSpawn);
+        stream.field(terrainSpriteSheetIndex);
+        stream.field(groundSpriteSheetIndex);
+        for (Random::Xoshiro128 *random: {&foodRandom, &enemyRandom, &combatRandom, &buddyRandom, &purchaseRandom}) {
+            stream.field(random->state);
+        }
+        collectingTimers.snapshot(stream);
+        fightingTimers.snapshot(stream);
+        stream.field(spawnTimer);
+        player.snapshot(stream);
+        playerBow->snapshot(stream);
+        foods.snapshot(stream);
+        projectiles.snapshot(stream);
+        enemies.snapshot(stream);
+        broccoliBuddies.snapshot(stream);
+        coins.resize(stream.count(coins.size()), Coin({0, 0}));
+        for (Coin &coin: coins) {
+            stream.field(coin.position);
+            stream.field(coin.shouldBeDestroyed);
+        }
+    }
+    // Reuses the writer's buffer, so saving every frame settles into no allocations at all.
+    void saveSnapshot(Snapshots::Writer &writer) {
+        writer.clear();
+        snapshot(writer);
+    }
+    // A snapshot that does not read back cleanly is undone, leaving the game as it was.
+    bool restoreSnapshot(const std::vector<char> &bytes) {
+        saveSnapshot(restoreBackup);
+        Snapshots::Reader reader(bytes.data(), bytes.size());
+        snapshot(reader);
+        if (reader.isValid() && reader.isAtEnd()) return true;
+        Snapshots::Reader backupReader(restoreBackup.bytes.data(), restoreBackup.bytes.size());
+        snapshot(backupReader);
+        return false;
+    }
+    bool saveSnapshotFile(const std::string &fileName) {
+        Snapshots::Writer writer;
+        saveSnapshot(writer);
+        return SnapshotFile::write(fileName, writer.bytes);
+    }
+    bool restoreSnapshotFile(const std::string &fileName) {
+        std::vector<char> payload;
+        return SnapshotFile::read(fileName, payload) && restoreSnapshot(payload);
+    }
+    // Called after every tick, so the newest entry is always the state on screen.
+    void recordRewind() {
+        if (rewind.budgetBytes == 0) return;
+        Profiling::Scope profile(profiler, PROFILE_REWIND);
+        TRACE_SCOPE(profileSectionNames[PROFILE_REWIND]);
+        saveSnapshot(rewindWriter);
+        rewind.record(rewindWriter.bytes);
+    }
+    void startScrubbing() {
+        if (rewind.size() == 0) return;
+        isScrubbing = true;
+        rewindIndex = rewind.size() - 1;
+    }
+    // Moves numTicks through the buffer, negative being back in time.
+    void scrub(long numTicks) {
+        size_t index = (size_t)std::clamp<long>((long)rewindIndex + numTicks, 0, (long)rewind.size() - 1);
+        if (index == rewindIndex) return;
+        if (rewind.get(index, rewindWriter.bytes) && restoreSnapshot(rewindWriter.bytes)) {
+            rewindIndex = index;
+        }
+    }
+    void stopScrubbing() {
+        rewind.truncate(rewindIndex + 1);
+        isScrubbing = false;
+    }
+    // The music thread does the streaming; this only tells it when the track or the pause
+    // state should change. A command that does not fit in the queue is retried next frame.
+    void updateMusic() {
+        int track = -1;
+        if (gameState == GameState::COLLECTING_FOOD) {
+            track = MUSIC_TRACK_COLLECTING;
         } else if (gameState == GameState::FIGHTING) {
-            for (auto &projectile: projectiles) {
-                if (projectile.position.x - 100 > WINDOW_WIDTH || projectile.position.x + 100 < 0 || projectile.position.y - 100 > WINDOW_HEIGHT || projectile.position.y + 100 < 0) {
-                    projectile.shouldBeDestroyed = true;
+            track = MUSIC_TRACK_FIGHTING;
+        }
+        if (track != musicTrack && musicThread.send({Sounds::MusicThread::CommandType::CROSSFADE, track, MUSIC_CROSSFADE_TIME})) {
+            musicTrack = track;
+        }
+        if (isPaused != isMusicPaused && musicThread.send({isPaused ? Sounds::MusicThread::CommandType::PAUSE : Sounds::MusicThread::CommandType::RESUME, 0, 0})) {
+            isMusicPaused = isPaused;
+        }
+    }
+    void checkForRemoval() {
+        Profiling::Scope profile(profiler, PROFILE_REMOVAL);
+        TRACE_SCOPE(profileSectionNames[PROFILE_REMOVAL]);
+        if (gameState == GameState::FIGHTING) {
+            for (size_t i = 0; i < projectiles.size(); i++) {
+                float x = projectiles.positionX[i], y = projectiles.positionY[i];
+                if (x - 100 > WINDOW_WIDTH || x + 100 < 0 || y - 100 > WINDOW_HEIGHT || y + 100 < 0) {
+                    projectiles.shouldBeDestroyed[i] = true;
                 }
             }
         }
     }
     void garbageCollect() {
+        Profiling::Scope profile(profiler, PROFILE_GARBAGE_COLLECTION);
+        TRACE_SCOPE(profileSectionNames[PROFILE_GARBAGE_COLLECTION]);
         if (gameState == GameState::COLLECTING_FOOD) {
-            for (int i = 0; i < goodFoods.size(); i++) {
-                if (goodFoods.at(i)->shouldBeDestroyed) {
-                    goodFoods.erase(goodFoods.begin() + i);
-                    i--;
-                }
-            }
-            for (int i = 0; i < badFoods.size(); i++) {
-                if (badFoods.at(i)->shouldBeDestroyed) {
-                    badFoods.erase(badFoods.begin() + i);
-                    i--;
-                }
-            }
+            foods.removeDestroyed();
         } else if (gameState == GameState::FIGHTING) {
-            for (int i = 0; i < projectiles.size(); i++) {
-                if (projectiles.at(i).shouldBeDestroyed) {
-                    projectiles.erase(projectiles.begin() + i);
-                    i--;
-                }
-            }
-            for (int i = 0; i < enemies.size(); i++) {
-                if (enemies.at(i)->isDead) {
-                    coins.push_back(Coin({enemies.at(i)->position.x + 60.0f, enemies.at(i)->position.y + 140.0f}));
-                    enemies.erase(enemies.begin() + i);
-                    i--;
-                }
-            }
-            for (int i = 0; i < coins.size(); i++) {
-                if (coins.at(i).shouldBeDestroyed) {
-                    coins.erase(coins.begin() + i);
-                    i--;
-                }
-            }
-            for (int i = 0; i < broccoliBuddies.size(); i++) {
-                if (broccoliBuddies.at(i)->shouldBeDestroyed) {
-                    broccoliBuddies.erase(broccoliBuddies.begin() + i);
-                    i--;
+            projectiles.removeDestroyed();
+            for (size_t i = 0; i < enemies.size(); i++) {
+                if (enemies.isDead[i]) {
+                    coins.push_back(Coin({enemies.positionX[i] + 60.0f, enemies.positionY[i] + 140.0f}));
                 }
             }
+            enemies.removeDead(fightingTimers);
+            coins.erase(std::remove_if(coins.begin(), coins.end(), [](const Coin &coin) {
+                return coin.shouldBeDestroyed;
+            }), coins.end());
+            broccoliBuddies.removeDestroyed(fightingTimers);
         }
     }
     void checkForCollisions() {
+        Profiling::Scope profile(profiler, PROFILE_COLLISIONS);
+        TRACE_SCOPE(profileSectionNames[PROFILE_COLLISIONS]);
         if (gameState == GameState::COLLECTING_FOOD) {
-            for (auto &goodFood: goodFoods) {
-                Vector2 goodFoodPosition = goodFood->position;
-                Vector2 goodFoodSize = goodFood->size;
-                if (CheckCollisionRecs({goodFoodPosition.x, goodFoodPosition.y, goodFoodSize.x, goodFoodSize.y}, {player.position.x, player.position.y, player.size.x, player.size.y})) {
-                    player.nutrition += goodFood->nutritionalValue;
-                    PlaySound(soundBite);
-                    goodFood->shouldBeDestroyed = true;
-                }
-            }
-            for (auto &badFood: badFoods) {
-                Vector2 badFoodPosition = badFood->position;
-                Vector2 badFoodSize = badFood->size;
-                if (CheckCollisionRecs({badFoodPosition.x, badFoodPosition.y, badFoodSize.x, badFoodSize.y}, {player.position.x, player.position.y, player.size.x, player.size.y})) {
-                    player.nutrition -= badFood->harmValue;
-                    PlaySound(soundBite);
-                    badFood->shouldBeDestroyed = true;
-                }
-            }
+            int numEaten = 0;
+            player.nutrition += foods.consumeOverlapping({player.position.x, player.position.y, player.size.x, player.size.y}, numEaten);
+            events.insert(events.end(), numEaten, GameEvent::FOOD_EATEN);
         } else if (gameState == GameState::FIGHTING) {
-            for (auto &projectile: projectiles) {
-                if (Collision::CheckCollisionRectCornersRec({player.position.x, player.position.y, player.size.x, player.size.y}, projectile.rectCorners) && !projectile.isPlayerProjectile) {
-                    int damage = GetRandomValue(5, 10);
-                    if (!player.isImmune) player.health -= damage;
-                    PlaySound(soundHit);
-                    projectile.shouldBeDestroyed = true;
-                }
+            collisionGrid.clear();
+            for (size_t i = 0; i < projectiles.size(); i++) {
+                uint32_t layer = projectiles.isPlayerProjectile[i] ? CollisionLayers::PLAYER_PROJECTILE : CollisionLayers::ENEMY_PROJECTILE;
+                collisionGrid.insert(Collision::GetOrientedBoxBounds(projectiles.getBox(i)), layer);
+            }
+            collisionGrid.build();
+            numCollisionPairs = 0;
+
+            Rectangle playerRect = {player.position.x, player.position.y, player.size.x, player.size.y};
+            prepareChunkBuffers(projectileHits, enemies.size(), ENEMY_COLLISION_GRAIN_SIZE);
+            ProjectileHits &playerHits = projectileHits[0];
+            int numCandidates = findProjectileHits(playerRect, CollisionLayers::HITS_PLAYER, playerHits);
+            for (int i = 0; i < numCandidates; i++) {
+                if (!playerHits.isHit[i]) continue;
+                int damage = combatRandom.uniformInt(5, 10);
+                if (!player.isImmune) player.health -= damage;
+                events.push_back(GameEvent::PROJECTILE_HIT);
+                projectiles.shouldBeDestroyed[playerHits.candidates[i]] = true;
             }
-            for (auto &enemy: enemies) {
-                for (auto &projectile: projectiles) {
-                    if (Collision::CheckCollisionRectCornersRec({enemy->position.x, enemy->position.y, enemy->size.x, enemy->size.y}, projectile.rectCorners) && projectile.isPlayerProjectile) {
-                        enemy->health -= playerBow->damage;
-                        PlaySound(soundHit);
-                        projectile.shouldBeDestroyed = true;
+            // Chunks only read the projectiles; whether an arrow is used up by an earlier
+            // enemy is settled while merging, in enemy order.
+            jobs->parallelFor(enemies.size(), ENEMY_COLLISION_GRAIN_SIZE, [&](size_t chunk, size_t begin, size_t end) {
+                ProjectileHits &hits = projectileHits[chunk];
+                for (size_t enemy = begin; enemy < end; enemy++) {
+                    int numEnemyCandidates = findProjectileHits(enemies.getRect(enemy), CollisionLayers::HITS_ENEMY, hits);
+                    for (int i = 0; i < numEnemyCandidates; i++) {
+                        if (hits.isHit[i]) hits.enemyHits.push_back({(uint32_t)enemy, hits.candidates[i]});
                     }
                 }
+            });
+            for (ProjectileHits &hits: projectileHits) {
+                numCollisionPairs += hits.numPairs;
+                for (const std::pair<uint32_t, int> &hit: hits.enemyHits) {
+                    if (projectiles.shouldBeDestroyed[hit.second]) continue;
+                    enemies.health[hit.first] -= playerBow->damage;
+                    events.push_back(GameEvent::PROJECTILE_HIT);
+                    projectiles.shouldBeDestroyed[hit.second] = true;
+                }
             }
             for (auto &coin: coins) {
                 if (CheckCollisionRecs({player.position.x, player.position.y, player.size.x, player.size.y}, {coin.position.x, coin.position.y, coin.size.x, coin.size.y})) {
-                    PlaySound(soundCollect);
+                    events.push_back(GameEvent::COIN_COLLECTED);
                     player.coins++;
                     coin.shouldBeDestroyed = true;
                 }
             }
         }
     }
+    // Gathers the live projectiles near rect on the given layers and runs the batched narrow
+    // phase over them. Results are left in hits.candidates and hits.isHit. Only reads the
+    // game, so chunks with their own ProjectileHits can call it at the same time.
+    int findProjectileHits(Rectangle rect, uint32_t layerMask, ProjectileHits &hits) const {
+        hits.candidates.clear();
+        hits.boxes.clear();
+        hits.numPairs += collisionGrid.query(rect, layerMask, [&](int i) {
+            if (projectiles.shouldBeDestroyed[i]) return;
+            hits.candidates.push_back(i);
+            hits.boxes.push_back(projectiles.getBox(i));
+        });
+        hits.isHit.resize(hits.boxes.size());
+        Collision::CheckCollisionRecBoxes(rect, hits.boxes.data(), (int)hits.boxes.size(), hits.isHit.data());
+        return (int)hits.candidates.size();
+    }
+    // Three rolls per food (position, fresh or spoilt, which food), drawn in one batch.
     void spawnFood() {
+        spawnRolls.resize(3 * spawnNumber);
+        foodRandom.fill(spawnRolls.data(), spawnRolls.size());
         for (int i = 0; i < spawnNumber; i++) {
-            Vector2 spawnPos = {(float)GetRandomValue(100, WINDOW_WIDTH - 100), -200.0f};
-            if (GetRandomValue(1, 2) == 1) {
-                int goodFoodIndex = GetRandomValue(1, 6);
-                switch (goodFoodIndex) {
-                    case 1:
-                        goodFoods.push_back(std::make_unique<Cheese>(spawnPos, 6.0f));
-                        break;
-                    case 2:
-                        goodFoods.push_back(std::make_unique<Apple>(spawnPos, 6.0f));
-                        break;
-                    case 3:
-                        goodFoods.push_back(std::make_unique<Banana>(spawnPos, 6.0f));
-                        break;
-                    case 4:
-                        goodFoods.push_back(std::make_unique<Pizza>(spawnPos, 6.0f));
-                        break;
-                    case 5:
-                        goodFoods.push_back(std::make_unique<Yoghurt>(spawnPos, 6.0f));
-                        break;
-                    case 6:
-                        goodFoods.push_back(std::make_unique<Potion>(spawnPos, 6.0f));
-                        break;
-                }
-            } else {
-                int badFoodIndex = GetRandomValue(1, 6);
-                switch (badFoodIndex) {
-                    case 1:
-                        badFoods.push_back(std::make_unique<SpoiltCheese>(spawnPos, 6.0f));
-                        break;
-                    case 2:
-                        badFoods.push_back(std::make_unique<SpoiltApple>(spawnPos, 6.0f));
-                        break;
-                    case 3:
-                        badFoods.push_back(std::make_unique<SpoiltBanana>(spawnPos, 6.0f));
-                        break;
-                    case 4:
-                        badFoods.push_back(std::make_unique<SpoiltPizza>(spawnPos, 6.0f));
-                        break;
-                    case 5:
-                        badFoods.push_back(std::make_unique<SpoiltYoghurt>(spawnPos, 6.0f));
-                        break;
-                    case 6:
-                        badFoods.push_back(std::make_unique<SpoiltPotion>(spawnPos, 6.0f));
-                        break;
-                }
-            }
+            const float *rolls = &spawnRolls[3 * i];
+            Vector2 spawnPos = {Lerp(100.0f, WINDOW_WIDTH - 100.0f, rolls[0]), -200.0f};
+            int firstKind = rolls[1] < 0.5f ? 0 : NUM_FRESH_FOOD_KINDS;
+            int kind = firstKind + static_cast<int>(rolls[2] * NUM_FRESH_FOOD_KINDS);
+            foods.spawn(spawnPos, 6.0f, static_cast<FoodKind>(kind));
         }
+        TRACE_INSTANT("spawnFood", spawnNumber);
     }
     void spawnEnemies() {
+        // Waves bigger than the five spawn points line extra enemies up behind them.
         for (int i = 0; i < numEnemiesToSpawn; i++) {
-            std::unique_ptr<Enemy> enemy = std::make_unique<Enemy>(enemySpawnPositions[i], &player.position);
-            std::unique_ptr<Bow> enemyBow = std::make_unique<Bow>(&enemy->position, &player.center, false, false, nullptr);
-            enemy->makeAssociatedBow(std::move(enemyBow));
-            enemies.push_back(std::move(enemy));
+            Vector2 offset = {(i / 5) % 8 * 40.0f, (i / 40) % 8 * 40.0f};
+            enemies.spawn(Vector2Add(enemySpawnPositions[i % 5], offset), enemyRandom.uniform(2.0f, 2.5f));
         }
+        TRACE_INSTANT("spawnEnemies", numEnemiesToSpawn);
     }
     void spawnBroccoliBuddy() {
-        Vector2 spawnPosition = {(float)GetRandomValue(100, WINDOW_WIDTH - 200), -200.0f};
-        std::unique_ptr<BroccoliBuddy> broccoliBuddy = std::make_unique<BroccoliBuddy>(spawnPosition, &enemies);
-        std::unique_ptr<Bow> broccoliBow = std::make_unique<Bow>(&broccoliBuddy->position, nullptr, false, true, &player.level);
-        broccoliBuddy->makeAssociatedBow(std::move(broccoliBow));
-        broccoliBuddies.push_back(std::move(broccoliBuddy));
+        Vector2 spawnPosition = {buddyRandom.uniform(100.0f, WINDOW_WIDTH - 200.0f), -200.0f};
+        broccoliBuddies.spawn(spawnPosition, buddyRandom.uniform(0.2f, 0.5f));
+        TRACE_INSTANT("spawnBroccoliBuddy", (int64_t)broccoliBuddies.size());
+    }
+    // Sizes a per-chunk buffer for a loop over count items and empties every chunk's buffer.
+    template <typename T>
+    void prepareChunkBuffers(std::vector<T> &buffers, size_t count, size_t grainSize) {
+        buffers.resize(std::max<size_t>(1, Jobs::JobSystem::getNumChunks(count, grainSize)));
+        for (T &buffer: buffers) buffer.clear();
     }
     void setGuiStyles() {
         GuiSetFont(font);
@@ -1300,6 +2836,13 @@ public:
         RayGuiTools::SetAllButtonTextStyles(ColorToInt(WHITE));
         RayGuiTools::SetAllButtonBorderStyles(ColorToInt(BLACK));
     }
+    void setGameState(GameState state) {
+        if (state == gameState) return;
+        // Traced under the new state's name, with the old state as the value.
+        static const char *const gameStateNames[] = {"titleScreen", "collectingFood", "fighting"};
+        TRACE_INSTANT(gameStateNames[static_cast<int>(state)], static_cast<int>(gameState));
+        gameState = state;
+    }
     void reset() {
         player.health = player.maxHealth;
         player.isDead = false;
@@ -1308,34 +2851,663 @@ public:
         player.isAttracting = false;
         player.isExtraFast = false;
         player.isImmune = false;
+        collectingTimers.cancel(player.attractionTimer);
+        fightingTimers.cancel(player.speedTimer);
+        fightingTimers.cancel(player.immunityTimer);
         playerBow->damage = playerBow->baseDamage;
         player.level = 1;
         projectiles.clear();
-        enemies.clear();
-        goodFoods.clear();
-        badFoods.clear();
+        enemies.clear(fightingTimers);
+        foods.clear();
         coins.clear();
-        broccoliBuddies.clear();
-        gameState = GameState::TITLE_SCREEN;
+        broccoliBuddies.clear(fightingTimers);
+        setGameState(GameState::TITLE_SCREEN);
         gameStateIndex = 0;
     }
 };
 
-int main() {
+// Scripted stand-in for a player, used by headless runs. It sweeps across the arena,
+// keeps shooting at the nearest enemy and spends everything it earns.
+InputState makeAutopilotInput(const Game &game, long tick, int gameStateIndex) {
+    InputState input;
+    if (game.gameState == Game::GameState::TITLE_SCREEN) {
+        input.selectedGameStateIndex = gameStateIndex;
+        input.mousePosition = {game.startButtonBounds.x + game.startButtonBounds.width / 2, game.startButtonBounds.y + game.startButtonBounds.height / 2};
+        input.isMouseLeftPressed = game.gameStateIndex == gameStateIndex;
+        return input;
+    }
+    bool isSweepingRight = (tick / 240) % 2 == 0;
+    input.isMovingRight = isSweepingRight;
+    input.isMovingLeft = !isSweepingRight;
+    if (game.gameState == Game::GameState::COLLECTING_FOOD) {
+        input.isPurchaseClicked = game.player.nutrition >= 1000;
+    } else {
+        input.isMovingUp = (tick / 180) % 2 == 0;
+        input.isMovingDown = !input.isMovingUp;
+        if (!game.enemies.empty()) {
+            input.mousePosition = game.enemies.getCenter(0);
+        }
+        input.isShootPressed = tick % 20 == 0;
+        input.isLevelUpClicked = game.player.nutrition > 0;
+        input.isBuyBroccoliBuddyClicked = game.player.coins >= 20;
+        input.isPurchaseClicked = !input.isBuyBroccoliBuddyClicked && game.player.coins >= 15;
+    }
+    return input;
+}
+
+// Command line numbers must be a number and nothing else. Returns false instead of throwing,
+// so a bad value is reported rather than ending the program.
+bool parseNumber(const char *text, long &value) {
+    char *end;
+    errno = 0;
+    value = std::strtol(text, &end, 10);
+    return end != text && *end == '\0' && errno == 0;
+}
+bool parseNumber(const char *text, int &value) {
+    long number;
+    if (!parseNumber(text, number) || number < INT_MIN || number > INT_MAX) return false;
+    value = static_cast<int>(number);
+    return true;
+}
+bool parseNumber(const char *text, double &value) {
+    char *end;
+    errno = 0;
+    value = std::strtod(text, &end);
+    return end != text && *end == '\0' && errno == 0 && std::isfinite(value);
+}
+int reportBadValue(const std::string &arg, const char *value) {
+    std::cerr << "Bad value for " << arg << ": " << value << std::endl;
+    return 1;
+}
+
+// Usage: falling_feast --pack-assets [output]
+// Decodes every asset once and writes them into an asset pack, next to the executable
+// unless an output path is given. Needs no window or audio device.
+int runPackAssets(int argc, char **argv) {
+    std::string outputPath = argc > 2 ? argv[2] : std::string(GetApplicationDirectory()) + ASSET_PACK_FILE_NAME;
+    AssetPack::Writer writer;
+    bool isMissingFiles = false;
+    auto checkFile = [&](const char *fileName) {
+        bool exists = FileExists(getAssetPath(fileName).c_str());
+        if (!exists) std::cerr << "missing: " << fileName << std::endl;
+        isMissingFiles = isMissingFiles || !exists;
+        return exists;
+    };
+
+    for (int i = 0; i < NUM_TEXTURE_KEYS; i++) checkFile(textureFileNames[i]);
+    for (int i = 0; i < NUM_SOUNDS; i++) checkFile(soundFileNames[i]);
+    for (int i = 0; i < NUM_MUSIC_STREAMS; i++) checkFile(musicFileNames[i]);
+    checkFile(FONT_FILE_NAME);
+    if (isMissingFiles) return 1;
+
+    Image atlas = loadAtlasImage();
+    writer.addImage(ATLAS_ENTRY_NAME, atlas);
+    UnloadImage(atlas);
+    for (int i = 0; i < NUM_TEXTURE_KEYS; i++) {
+        Image image = LoadImage(getAssetPath(textureFileNames[i]).c_str());
+        ImageFormat(&image, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+        // Atlas sprites only need their size, their pixels are already in the atlas.
+        writer.addImage(textureFileNames[i], image, i >= NUM_ATLAS_SPRITES);
+        UnloadImage(image);
+    }
+    for (int i = 0; i < NUM_SOUNDS; i++) {
+        Wave wave = LoadWave(getAssetPath(soundFileNames[i]).c_str());
+        writer.addWave(soundFileNames[i], wave);
+        UnloadWave(wave);
+    }
+    for (int i = 0; i < NUM_MUSIC_STREAMS; i++) {
+        int dataSize = 0;
+        unsigned char *data = LoadFileData(getAssetPath(musicFileNames[i]).c_str(), &dataSize);
+        writer.addFile(musicFileNames[i], data, dataSize);
+        UnloadFileData(data);
+    }
+    // Baked the same way LoadFontEx does it.
+    int fontDataSize = 0;
+    unsigned char *fontData = LoadFileData(getAssetPath(FONT_FILE_NAME).c_str(), &fontDataSize);
+    GlyphInfo *glyphs = LoadFontData(fontData, fontDataSize, FONT_BASE_SIZE, nullptr, FONT_GLYPH_COUNT, FONT_DEFAULT);
+    Rectangle *recs = nullptr;
+    Image fontAtlas = GenImageFontAtlas(glyphs, &recs, FONT_GLYPH_COUNT, FONT_BASE_SIZE, FONT_TTF_DEFAULT_CHARS_PADDING, 0);
+    writer.addFont(FONT_FILE_NAME, FONT_BASE_SIZE, FONT_TTF_DEFAULT_CHARS_PADDING, glyphs, recs, FONT_GLYPH_COUNT, fontAtlas);
+    UnloadImage(fontAtlas);
+    MemFree(recs);
+    UnloadFontData(glyphs, FONT_GLYPH_COUNT);
+    UnloadFileData(fontData);
+
+    if (!writer.save(outputPath.c_str())) {
+        std::cerr << "could not write " << outputPath << std::endl;
+        return 1;
+    }
+    std::cout << "wrote " << writer.entries.size() << " entries to " << outputPath << std::endl;
+    return 0;
+}
+
+// Runs the simulation with no window or audio device and reports its throughput.
+// Usage: falling_feast --headless [--mode collecting|fighting] [--ticks N] [--render] [--record file]
+//                                 [--threads N] [--enemies N] [--snapshot file] [--save-snapshot file]
+//                                 [--rewind MB] [--rewind-keyframe ticks]
+// --render also queues and sorts every frame's sprites, without drawing, for batching stats.
+// --threads sets how many threads share the entity loops (default: one per core) and
+// --enemies the size of each fighting wave, for stress runs. --snapshot starts from a saved
+// game instead of the title screen, and --save-snapshot saves the game the run ends on.
+// --rewind records every tick into a rewind buffer of that size, to measure what it costs.
+int runHeadless(int argc, char **argv) {
+    int gameStateIndex = 0;
+    long numTicks = 100000;
+    bool shouldRender = false;
+    const char *recordingFileName = nullptr;
+    const char *snapshotFileName = nullptr;
+    const char *savedSnapshotFileName = nullptr;
+    int numThreads = 0;
+    int waveSize = 0;
+    double rewindMegabytes = 0;
+    int rewindKeyframeInterval = REWIND_KEYFRAME_INTERVAL;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--render") {
+            shouldRender = true;
+        } else if (arg == "--record" && i + 1 < argc) {
+            recordingFileName = argv[++i];
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            snapshotFileName = argv[++i];
+        } else if (arg == "--save-snapshot" && i + 1 < argc) {
+            savedSnapshotFileName = argv[++i];
+        } else if (arg == "--mode" && i + 1 < argc) {
+            gameStateIndex = std::string(argv[++i]) == "fighting" ? 1 : 0;
+        } else if (arg == "--ticks" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], numTicks) || numTicks < 0) return reportBadValue(arg, argv[i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], numThreads) || numThreads < 1) return reportBadValue(arg, argv[i]);
+        } else if (arg == "--enemies" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], waveSize) || waveSize < 1) return reportBadValue(arg, argv[i]);
+        } else if (arg == "--rewind" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], rewindMegabytes) || rewindMegabytes < 0) return reportBadValue(arg, argv[i]);
+        } else if (arg == "--rewind-keyframe" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], rewindKeyframeInterval) || rewindKeyframeInterval < 1) return reportBadValue(arg, argv[i]);
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+    SetTraceLogLevel(LOG_WARNING);
+    Game game = Game(true);
+    game.rewind.budgetBytes = (size_t)(rewindMegabytes * 1048576.0);
+    game.rewind.keyframeInterval = rewindKeyframeInterval;
+    if (snapshotFileName != nullptr && !game.restoreSnapshotFile(snapshotFileName)) {
+        std::cerr << "not a snapshot for this build: " << snapshotFileName << std::endl;
+        return 1;
+    }
+    if (numThreads > 0) game.jobs = std::make_unique<Jobs::JobSystem>(numThreads);
+    if (waveSize > 0) game.numEnemiesToSpawn = waveSize;
+    InputLog::Recorder recorder;
+    if (recordingFileName != nullptr && !recorder.open(recordingFileName, game.seed, game.numEnemiesToSpawn)) {
+        std::cerr << "could not write " << recordingFileName << std::endl;
+        return 1;
+    }
+    long numEvents = 0;
+    long numDeaths = 0;
+    long numDrawCalls = 0;
+    long numBatches = 0;
+    long numUnsortedBatches = 0;
+    std::chrono::steady_clock::duration rewindTime{};
+
+    auto startTime = std::chrono::steady_clock::now();
+    for (long tick = 0; tick < numTicks; tick++) {
+        InputState input = makeAutopilotInput(game, tick, gameStateIndex);
+        game.update(input, TICK_TIME);
+        if (recorder.isOpen()) recorder.write(input, game.computeStateHash());
+        if (game.rewind.budgetBytes > 0) {
+            auto rewindStart = std::chrono::steady_clock::now();
+            game.recordRewind();
+            rewindTime += std::chrono::steady_clock::now() - rewindStart;
+        }
+        for (GameEvent event: game.events) {
+            if (event == GameEvent::PLAYER_DIED) numDeaths++;
+        }
+        numEvents += game.events.size();
+        game.events.clear();
+        if (shouldRender) {
+            game.submitSprites(1.0f);
+            game.renderQueue.flush(false);
+            numDrawCalls += game.renderQueue.numDrawCalls;
+            numBatches += game.renderQueue.numBatches;
+            numUnsortedBatches += game.renderQueue.numUnsortedBatches;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::cout << "mode: " << (gameStateIndex == 0 ? "collecting" : "fighting") << std::endl;
+    std::cout << "ticks: " << numTicks << std::endl;
+    std::cout << "seconds: " << seconds << std::endl;
+    std::cout << "ticks_per_second: " << (seconds > 0 ? numTicks / seconds : 0) << std::endl;
+    std::cout << "events: " << numEvents << std::endl;
+    std::cout << "deaths: " << numDeaths << std::endl;
+    std::cout << "nutrition: " << game.player.nutrition << std::endl;
+    std::cout << "coins: " << game.player.coins << std::endl;
+    std::cout << "projectile_pool_capacity: " << game.projectiles.capacity() << std::endl;
+    std::cout << "projectile_pool_high_water_mark: " << game.projectiles.highWaterMark << std::endl;
+    std::cout << "projectiles_dropped: " << game.projectiles.numDropped << std::endl;
+    std::cout << "threads: " << game.jobs->getNumThreads() << std::endl;
+    std::cout << "chunks_stolen: " << game.jobs->numSteals << std::endl;
+    if (shouldRender) {
+        std::cout << "sprites_per_frame: " << (double)numDrawCalls / numTicks << std::endl;
+        std::cout << "batches_per_frame: " << (double)numBatches / numTicks << std::endl;
+        std::cout << "unsorted_batches_per_frame: " << (double)numUnsortedBatches / numTicks << std::endl;
+    }
+    if (game.rewind.budgetBytes > 0) {
+        std::cout << "rewind_seconds: " << (double)game.rewind.size() / TICK_RATE << std::endl;
+        std::cout << "rewind_bytes: " << game.rewind.getNumBytes() << std::endl;
+        std::cout << "rewind_uncompressed_bytes: " << game.rewind.getNumRawBytes() << std::endl;
+        std::cout << "rewind_record_microseconds: " << std::chrono::duration<double, std::micro>(rewindTime).count() / numTicks << std::endl;
+    }
+    if (savedSnapshotFileName != nullptr) {
+        // Restored straight back to check it round-trips. Both are timed in memory, apart
+        // from the file write, the second time round, once the buffers have grown.
+        uint64_t stateHash = game.computeStateHash();
+        Snapshots::Writer writer;
+        game.saveSnapshot(writer);
+        game.restoreSnapshot(writer.bytes);
+        auto saveStart = std::chrono::steady_clock::now();
+        game.saveSnapshot(writer);
+        auto restoreStart = std::chrono::steady_clock::now();
+        bool isRestored = game.restoreSnapshot(writer.bytes);
+        auto restoreEnd = std::chrono::steady_clock::now();
+        if (!isRestored || game.computeStateHash() != stateHash || !SnapshotFile::write(savedSnapshotFileName, writer.bytes)) {
+            std::cerr << "could not write " << savedSnapshotFileName << std::endl;
+            return 1;
+        }
+        std::cout << "snapshot_bytes: " << writer.bytes.size() << std::endl;
+        std::cout << "snapshot_save_microseconds: " << std::chrono::duration<double, std::micro>(restoreStart - saveStart).count() << std::endl;
+        std::cout << "snapshot_restore_microseconds: " << std::chrono::duration<double, std::micro>(restoreEnd - restoreStart).count() << std::endl;
+    }
+    return 0;
+}
+
+// Scripted loads for --benchmark. Each is topped back up to its count every tick, so the
+// load stays the same for the whole run.
+enum class BenchmarkScenario {
+    FOODS,   // foods falling at once, in collecting mode
+    ENEMIES, // enemies in every wave
+    ARROWS,  // arrows in flight
+    BUDDIES, // broccoli buddies alive, replaced as they expire
+};
+struct BenchmarkScenarioInfo {
+    const char *name;
+    BenchmarkScenario scenario;
+    int gameStateIndex;
+    int defaultCount;
+};
+const BenchmarkScenarioInfo benchmarkScenarios[] = {
+    {"foods", BenchmarkScenario::FOODS, 0, 8000},
+    {"enemies", BenchmarkScenario::ENEMIES, 1, 1000},
+    {"arrows", BenchmarkScenario::ARROWS, 1, 2000},
+    {"buddies", BenchmarkScenario::BUDDIES, 1, 50},
+};
+
+// The player is kept immune in the fighting scenarios, so the run is never cut short by
+// a reset back to the title screen.
+void topUpBenchmarkScenario(Game &game, BenchmarkScenario scenario, int count, Random::Xoshiro128 &random) {
+    if (scenario == BenchmarkScenario::FOODS) {
+        if (game.gameState != Game::GameState::COLLECTING_FOOD) return;
+        while ((int)game.foods.size() < count) {
+            Vector2 position = {random.uniform(100.0f, WINDOW_WIDTH - 100.0f), random.uniform(-200.0f, (float)WINDOW_HEIGHT)};
+            game.foods.spawn(position, 6.0f, static_cast<FoodKind>(random.uniformInt(0, NUM_FOOD_KINDS - 1)));
+        }
+        return;
+    }
+    if (game.gameState != Game::GameState::FIGHTING) return;
+    game.player.isImmune = true;
+    if (scenario == BenchmarkScenario::ARROWS) {
+        while ((int)game.projectiles.size() < count) {
+            Vector2 position = {random.uniform(0.0f, (float)WINDOW_WIDTH), random.uniform(0.0f, (float)WINDOW_HEIGHT)};
+            game.projectiles.spawn(position, random.nextBool(), random.uniform(-180.0f, 180.0f));
+        }
+    } else if (scenario == BenchmarkScenario::BUDDIES) {
+        while ((int)game.broccoliBuddies.size() < count) {
+            game.spawnBroccoliBuddy();
+        }
+    }
+}
+
+struct TimingSummary {
+    double mean = 0;
+    double p50 = 0;
+    double p95 = 0;
+    double p99 = 0;
+    double max = 0;
+};
+
+// Nearest-rank percentiles of times in milliseconds.
+TimingSummary summarizeTimes(std::vector<double> times) {
+    TimingSummary summary;
+    if (times.empty()) return summary;
+    std::sort(times.begin(), times.end());
+    auto percentile = [&](double p) {
+        size_t rank = (size_t)std::ceil(p / 100.0 * times.size());
+        return times[std::clamp<size_t>(rank, 1, times.size()) - 1];
+    };
+    for (double time: times) summary.mean += time;
+    summary.mean /= times.size();
+    summary.p50 = percentile(50);
+    summary.p95 = percentile(95);
+    summary.p99 = percentile(99);
+    summary.max = times.back();
+    return summary;
+}
+
+void writeTimingJson(std::ostream &out, const char *name, const TimingSummary &summary) {
+    out << "  \"" << name << "\": {\"mean\": " << summary.mean << ", \"p50\": " << summary.p50 << ", \"p95\": " << summary.p95
+        << ", \"p99\": " << summary.p99 << ", \"max\": " << summary.max << "}";
+}
+
+// Usage: falling_feast --benchmark <foods|enemies|arrows|buddies> [--count N] [--ticks N]
+//                                  [--warmup N] [--render] [--threads N] [--output file]
+//                                  [--snapshot file]
+// Runs one scenario headless for a fixed number of ticks after a warm-up and prints JSON
+// with the tick time (the update alone) and the frame time (the whole loop iteration,
+// including queueing and sorting the sprites with --render) in milliseconds. --output
+// also writes it to a file, for comparing builds.
+int runBenchmark(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: falling_feast --benchmark <foods|enemies|arrows|buddies> [--count N] [--ticks N] [--warmup N] [--render] [--threads N] [--output file] [--snapshot file]" << std::endl;
+        return 1;
+    }
+    const BenchmarkScenarioInfo *scenario = nullptr;
+    for (const BenchmarkScenarioInfo &info: benchmarkScenarios) {
+        if (std::string(argv[2]) == info.name) scenario = &info;
+    }
+    if (scenario == nullptr) {
+        std::cerr << "Unknown scenario: " << argv[2] << std::endl;
+        return 1;
+    }
+    int count = scenario->defaultCount;
+    long numTicks = 3000;
+    long numWarmupTicks = 120;
+    bool shouldRender = false;
+    int numThreads = 0;
+    const char *outputFileName = nullptr;
+    const char *snapshotFileName = nullptr;
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--render") {
+            shouldRender = true;
+        } else if (arg == "--count" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], count) || count < 0) return reportBadValue(arg, argv[i]);
+        } else if (arg == "--ticks" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], numTicks) || numTicks < 1) return reportBadValue(arg, argv[i]);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], numWarmupTicks) || numWarmupTicks < 0) return reportBadValue(arg, argv[i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], numThreads) || numThreads < 1) return reportBadValue(arg, argv[i]);
+        } else if (arg == "--output" && i + 1 < argc) {
+            outputFileName = argv[++i];
+        } else if (arg == "--snapshot" && i + 1 < argc) {
+            snapshotFileName = argv[++i];
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            return 1;
+        }
+    }
+    SetTraceLogLevel(LOG_WARNING);
+    // A fixed seed, so two builds are measured on exactly the same run.
+    constexpr unsigned int BENCHMARK_SEED = 1;
+    Game game = Game(true, BENCHMARK_SEED);
+    // Or from the same saved game every time, e.g. one in the middle of a fight.
+    if (snapshotFileName != nullptr && !game.restoreSnapshotFile(snapshotFileName)) {
+        std::cerr << "not a snapshot for this build: " << snapshotFileName << std::endl;
+        return 1;
+    }
+    Random::Xoshiro128 scenarioRandom = Random::Xoshiro128(BENCHMARK_SEED, 100);
+    if (numThreads > 0) game.jobs = std::make_unique<Jobs::JobSystem>(numThreads);
+    if (scenario->scenario == BenchmarkScenario::FOODS) {
+        count = std::min<int>(count, FOOD_POOL_CAPACITY);
+    } else if (scenario->scenario == BenchmarkScenario::ENEMIES) {
+        game.numEnemiesToSpawn = count;
+    } else if (scenario->scenario == BenchmarkScenario::ARROWS && (size_t)count > game.projectiles.capacity()) {
+        game.projectiles = ProjectilePool(count);
+    }
+
+    std::vector<double> tickTimes;
+    std::vector<double> frameTimes;
+    tickTimes.reserve(numTicks);
+    frameTimes.reserve(numTicks);
+    long numEvents = 0;
+    auto startTime = std::chrono::steady_clock::now();
+    for (long tick = -numWarmupTicks; tick < numTicks; tick++) {
+        auto frameStart = std::chrono::steady_clock::now();
+        topUpBenchmarkScenario(game, scenario->scenario, count, scenarioRandom);
+        InputState input = makeAutopilotInput(game, tick + numWarmupTicks, scenario->gameStateIndex);
+        auto tickStart = std::chrono::steady_clock::now();
+        game.update(input, TICK_TIME);
+        auto tickEnd = std::chrono::steady_clock::now();
+        if (tick >= 0) numEvents += game.events.size();
+        game.events.clear();
+        if (shouldRender) {
+            game.submitSprites(1.0f);
+            game.renderQueue.flush(false);
+        }
+        auto frameEnd = std::chrono::steady_clock::now();
+        if (tick == -1) startTime = frameEnd;
+        if (tick < 0) continue;
+        tickTimes.push_back(std::chrono::duration<double, std::milli>(tickEnd - tickStart).count());
+        frameTimes.push_back(std::chrono::duration<double, std::milli>(frameEnd - frameStart).count());
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    auto writeJson = [&](std::ostream &out) {
+        out << "{\n";
+        out << "  \"scenario\": \"" << scenario->name << "\",\n";
+        out << "  \"count\": " << count << ",\n";
+        out << "  \"ticks\": " << numTicks << ",\n";
+        out << "  \"warmup_ticks\": " << numWarmupTicks << ",\n";
+        out << "  \"render\": " << (shouldRender ? "true" : "false") << ",\n";
+        out << "  \"threads\": " << game.jobs->getNumThreads() << ",\n";
+        out << "  \"seconds\": " << seconds << ",\n";
+        out << "  \"ticks_per_second\": " << (seconds > 0 ? numTicks / seconds : 0) << ",\n";
+        out << "  \"events\": " << numEvents << ",\n";
+        writeTimingJson(out, "tick_ms", summarizeTimes(tickTimes));
+        out << ",\n";
+        writeTimingJson(out, "frame_ms", summarizeTimes(frameTimes));
+        out << "\n}" << std::endl;
+    };
+    writeJson(std::cout);
+    if (outputFileName != nullptr) {
+        std::ofstream file(outputFileName);
+        writeJson(file);
+        if (!file.good()) {
+            std::cerr << "could not write " << outputFileName << std::endl;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Usage: falling_feast --replay <recording> [--threads N]
+// Runs a recorded session without a window as fast as possible, checking the state hash
+// after every tick, and reports the first tick that diverges. Replaying with a different
+// thread count than the recording checks that the parallel loops are deterministic.
+int runReplay(int argc, char **argv) {
+    int numThreads = 0;
+    bool hasThreads = argc == 5 && std::string(argv[3]) == "--threads" && parseNumber(argv[4], numThreads) && numThreads >= 1;
+    if (argc < 3 || (argc > 3 && !hasThreads)) {
+        std::cerr << "Usage: falling_feast --replay <recording> [--threads n]" << std::endl;
+        return 1;
+    }
+    InputLog::Replay replay;
+    if (!replay.open(argv[2])) {
+        std::cerr << "not a recording for this build: " << argv[2] << std::endl;
+        return 1;
+    }
+    SetTraceLogLevel(LOG_WARNING);
+    Game game = Game(true, replay.header.seed);
+    game.numEnemiesToSpawn = replay.header.waveSize;
+    if (hasThreads) game.jobs = std::make_unique<Jobs::JobSystem>(numThreads);
+    InputState input;
+    uint64_t expectedHash;
+    long numTicks = 0;
+    long divergedTick = -1;
+
+    auto startTime = std::chrono::steady_clock::now();
+    while (replay.next(input, expectedHash)) {
+        game.update(input, TICK_TIME);
+        game.events.clear();
+        if (game.computeStateHash() != expectedHash) {
+            divergedTick = numTicks;
+            break;
+        }
+        numTicks++;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+
+    std::cout << "ticks: " << numTicks << std::endl;
+    std::cout << "seconds: " << seconds << std::endl;
+    std::cout << "ticks_per_second: " << (seconds > 0 ? numTicks / seconds : 0) << std::endl;
+    if (divergedTick >= 0) {
+        std::cout << "diverged_at_tick: " << divergedTick << std::endl;
+        return 1;
+    }
+    std::cout << "diverged_at_tick: none" << std::endl;
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    auto launchTime = std::chrono::steady_clock::now();
+    // --trace <file> can go anywhere on the command line, with any of the modes below.
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) != "--trace") continue;
+        if (i + 1 >= argc) {
+            std::cerr << "--trace needs a file name" << std::endl;
+            return 1;
+        }
+#if FALLING_FEAST_TRACING
+        if (!traceWriter.start(argv[i + 1])) {
+            std::cerr << "could not write " << argv[i + 1] << std::endl;
+            return 1;
+        }
+#else
+        std::cerr << "this build has tracing compiled out (FALLING_FEAST_TRACING=0)" << std::endl;
+        return 1;
+#endif
+        std::copy(argv + i + 2, argv + argc, argv + i);
+        argc -= 2;
+        break;
+    }
+    if (argc > 1 && std::string(argv[1]) == "--headless") {
+        return runHeadless(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--pack-assets") {
+        return runPackAssets(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--replay") {
+        return runReplay(argc, argv);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--benchmark") {
+        return runBenchmark(argc, argv);
+    }
+    // Usage: falling_feast [--record file] [--rewind MB] [--rewind-keyframe ticks]
+    const char *recordingFileName = nullptr;
+    double rewindMegabytes = REWIND_BUDGET_BYTES / 1048576.0;
+    int rewindKeyframeInterval = REWIND_KEYFRAME_INTERVAL;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--record" && i + 1 < argc) {
+            recordingFileName = argv[++i];
+        } else if (arg == "--rewind" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], rewindMegabytes) || rewindMegabytes < 0) return reportBadValue(arg, argv[i]);
+        } else if (arg == "--rewind-keyframe" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], rewindKeyframeInterval) || rewindKeyframeInterval < 1) return reportBadValue(arg, argv[i]);
+        } else {
+            std::cerr << "Unknown argument: " << arg << std::endl;
+            std::cerr << "Usage: falling_feast [--record file] [--rewind MB] [--rewind-keyframe ticks] [--trace file]" << std::endl;
+            std::cerr << "   or: falling_feast --headless|--replay|--benchmark|--pack-assets ..." << std::endl;
+            return 1;
+        }
+    }
     InitWindow(WINDOW_WIDTH, WINDOW_HEIGHT, "Falling Feast");
     SetTargetFPS(FPS);
     Game game = Game();
+    FixedTimestep timestep;
+    InputState input;
+    bool isFirstFrame = true;
+    // falling_feast --record <file> saves the session for --replay, which starts from the
+    // seed, so a recorded session always starts a new game instead of resuming.
+    InputLog::Recorder recorder;
+    std::string savedGamePath = std::string(GetApplicationDirectory()) + SnapshotFile::SAVED_GAME_FILE_NAME;
+    game.rewind.budgetBytes = (size_t)(rewindMegabytes * 1048576.0);
+    game.rewind.keyframeInterval = rewindKeyframeInterval;
+    if (recordingFileName != nullptr) {
+        if (!recorder.open(recordingFileName, game.seed, game.numEnemiesToSpawn)) {
+            TraceLog(LOG_WARNING, "Could not write %s, not recording", recordingFileName);
+        }
+    } else if (FileExists(savedGamePath.c_str())) {
+        auto restoreStart = std::chrono::steady_clock::now();
+        if (game.restoreSnapshotFile(savedGamePath)) {
+            std::chrono::duration<double, std::micro> restoreTime = std::chrono::steady_clock::now() - restoreStart;
+            TraceLog(LOG_INFO, "Resumed the saved game in %.0f us", restoreTime.count());
+            // Back on the title screen, where Start carries on and New Game starts over.
+            game.setGameState(Game::GameState::TITLE_SCREEN);
+        } else {
+            TraceLog(LOG_WARNING, "%s is not a saved game for this version, starting a new one", savedGamePath.c_str());
+        }
+    }
 
     while (!WindowShouldClose()) {
-        BeginDrawing();
-        ClearBackground(BLACK);
-
-        game.update();
-        game.draw();
-
-        EndDrawing();
+        {
+            Profiling::Scope profileFrame(game.profiler, PROFILE_FRAME);
+            TRACE_SCOPE(profileSectionNames[PROFILE_FRAME]);
+            BeginDrawing();
+            ClearBackground(BLACK);
+
+            input.latch(game.takeGuiInput(pollInput()));
+            // Scrubbing would jump a recording's state around, so it is off while recording.
+            if (game.isDebugging && !recorder.isOpen() && IsKeyPressed(KEY_R)) {
+                if (game.isScrubbing) {
+                    game.stopScrubbing();
+                } else {
+                    game.startScrubbing();
+                }
+            }
+            if (game.isScrubbing) {
+                // One tick per frame while an arrow is held, eight with Shift.
+                int direction = (int)IsKeyDown(KEY_RIGHT) - (int)IsKeyDown(KEY_LEFT);
+                game.scrub(direction * (IsKeyDown(KEY_LEFT_SHIFT) ? 8 : 1));
+                input.clearPresses();
+            } else {
+                int numTicks = timestep.advance(GetFrameTime());
+                for (int i = 0; i < numTicks; i++) {
+                    game.update(input, TICK_TIME);
+                    if (recorder.isOpen()) recorder.write(input, game.computeStateHash());
+                    game.recordRewind();
+                    input.clearPresses();
+                }
+            }
+            game.updateMusic();
+            for (GameEvent event: game.events) {
+                playEventSound(event);
+            }
+            voicePool.play();
+            game.events.clear();
+            game.draw(timestep.alpha());
+        }
+        {
+            Profiling::Scope profileEndDrawing(game.profiler, PROFILE_END_DRAWING);
+            TRACE_SCOPE(profileSectionNames[PROFILE_END_DRAWING]);
+            EndDrawing();
+        }
+        game.profiler.endFrame();
+        if (isFirstFrame) {
+            std::chrono::duration<double, std::milli> startupTime = std::chrono::steady_clock::now() - launchTime;
+            TraceLog(LOG_INFO, "Launch to first frame: %.1f ms (assets from %s)", startupTime.count(), isLoadedFromPack ? ASSET_PACK_FILE_NAME : "loose files");
+            isFirstFrame = false;
+        }
     }
 
+    if (!game.saveSnapshotFile(savedGamePath)) {
+        TraceLog(LOG_WARNING, "Could not save the game to %s", savedGamePath.c_str());
+    }
+    musicThread.stop();
+#if FALLING_FEAST_TRACING
+    traceWriter.stop();
+#endif
     CloseWindow();
     return 0;
 }
\ No newline at end of file